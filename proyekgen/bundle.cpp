@@ -0,0 +1,1058 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "bundle.h"
+
+/*
+ * Layout of a bundle, every integer is little-endian:
+ *
+ *   header   "PGBUNDL1", u32 version, u32 flags
+ *   chunks   independent xz streams, since version 2 the data of
+ *            an entry may continue over the following chunks
+ *   index    chunk records (u64 offset, u64 compressed size, u64 size)
+ *            entry records (64 bytes each, see TemplateBundle::entry)
+ *            hash buckets (u32 entry index + 1, 0 if empty)
+ *            string table (paths and symlink targets)
+ *   trailer  u64 index offset, u64 strings offset, u32 chunk count,
+ *            u32 entry count, u32 bucket count, u32 reserved, "PGBINDEX"
+*/
+static const char bundle_magic[] = "PGBUNDL1";
+static const char bundle_index_magic[] = "PGBINDEX";
+static const size_t bundle_header_size = 16;
+static const size_t bundle_chunk_size = 24;
+static const size_t bundle_entry_size = 64;
+static const size_t bundle_trailer_size = 40;
+static const uint32_t bundle_no_chunk = 0xffffffff;
+static const uint32_t bundle_version = 2;
+
+const string TemplateBundle::bundle_name = "project.pgb";
+
+static uint64_t bundle_read(const unsigned char *data, int bytes)
+{
+	uint64_t value = 0;
+
+	for (int i = bytes - 1; i >= 0; i--) {
+		value = (value << 8) | data[i];
+	}
+
+	return value;
+}
+
+static void bundle_write(string &out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+	}
+}
+
+static uint64_t bundle_hash(const string &pathname)
+{
+	// FNV-1a, only used for the index hash table
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (unsigned char c : pathname) {
+		hash = (hash ^ c) * 0x100000001b3;
+	}
+
+	return hash;
+}
+
+static bool bundle_compress(const vector<char> &data, vector<char> &compressed)
+{
+	struct archive *writer = archive_write_new();
+	struct archive_entry *entry = archive_entry_new();
+	size_t used = 0;
+	int result;
+
+	compressed.resize(data.size() + data.size() / 2 + 65536);
+	archive_write_add_filter_xz(writer);
+	archive_write_set_format_raw(writer);
+	archive_write_set_bytes_in_last_block(writer, 1);
+	result = archive_write_open_memory(writer, compressed.data(), compressed.size(), &used);
+	archive_entry_set_pathname(entry, "chunk");
+	archive_entry_set_filetype(entry, AE_IFREG);
+	archive_entry_set_size(entry, static_cast<la_int64_t>(data.size()));
+
+	if (result == ARCHIVE_OK) {
+		result = archive_write_header(writer, entry);
+	}
+	if (result == ARCHIVE_OK && !data.empty() && archive_write_data(writer, data.data(), data.size()) < 0) {
+		result = ARCHIVE_FATAL;
+	}
+	if (result == ARCHIVE_OK) {
+		result = archive_write_close(writer);
+	}
+
+	archive_entry_free(entry);
+	archive_write_free(writer);
+	compressed.resize(used);
+	return result == ARCHIVE_OK;
+}
+
+TemplateBundle::TemplateBundle(const file_path &path)
+	: _path(path)
+{}
+
+TemplateBundle::~TemplateBundle()
+{
+#if defined(__linux__)
+	if (_data != nullptr && _buffer.empty()) {
+		munmap(const_cast<unsigned char*>(_data), _size);
+	}
+#endif
+}
+
+/*
+ * Returns the path of the bundle.
+*/
+file_path TemplateBundle::path()
+{
+	return _path;
+}
+
+/*
+ * Returns true if a tar archive next to the bundle is newer than the bundle.
+ *
+ * The bundle was converted from an older version of the project data then.
+*/
+bool TemplateBundle::outdated()
+{
+	error_code error;
+	filesystem::file_time_type converted = filesystem::last_write_time(_path, error);
+
+	if (error) {
+		return false;
+	}
+	for (const char *project_file : {"project.tar.xz", "project.tar.zst"}) {
+		filesystem::file_time_type modified = filesystem::last_write_time(_path.parent_path() / project_file, error);
+
+		if (!error && modified > converted) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Set how much file metadata is restored when extracting the bundle.
+*/
+void TemplateBundle::set_metadata(TemplateMetadataPolicy metadata)
+{
+	_metadata = metadata;
+}
+
+/*
+ * Map the bundle into memory and read its index.
+ *
+ * Returns false if the bundle cannot be read or is malformed.
+*/
+bool TemplateBundle::open()
+{
+#if defined(__linux__)
+	int fd = ::open(_path.string().c_str(), O_RDONLY);
+	struct stat info;
+
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return false;
+	}
+
+	void *mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+		return false;
+	}
+
+	_data = static_cast<const unsigned char*>(mapped);
+	_size = static_cast<size_t>(info.st_size);
+#else
+	file_input stream(_path, std::ios::binary);
+	_buffer.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	_data = _buffer.data();
+	_size = _buffer.size();
+#endif
+
+	if (_size < bundle_header_size + bundle_trailer_size || memcmp(_data, bundle_magic, 8) != 0 ||
+		memcmp(_data + _size - 8, bundle_index_magic, 8) != 0) {
+		fmt::print("Invalid template bundle: {0:s}\n", _path);
+		return false;
+	}
+	if (bundle_read(_data + 8, 4) > bundle_version) {
+		fmt::print("Unsupported template bundle version: {0:s}\n", _path);
+		return false;
+	}
+
+	const unsigned char *trailer = _data + _size - bundle_trailer_size;
+	_index_offset = bundle_read(trailer, 8);
+	_strings_offset = bundle_read(trailer + 8, 8);
+	_chunk_count = static_cast<uint32_t>(bundle_read(trailer + 16, 4));
+	_entry_count = static_cast<uint32_t>(bundle_read(trailer + 20, 4));
+	_bucket_count = static_cast<uint32_t>(bundle_read(trailer + 24, 4));
+
+	if (_index_offset < bundle_header_size || _index_offset > _size ||
+		_index_offset + _chunk_count * bundle_chunk_size + _entry_count * bundle_entry_size +
+		_bucket_count * 4ull != _strings_offset || _strings_offset > _size - bundle_trailer_size) {
+		fmt::print("Invalid template bundle index: {0:s}\n", _path);
+		return false;
+	}
+
+	// Every entry's strings and chunk are checked once, so entry() can't read outside the bundle.
+	// Empty files may point past the last chunk, they don't have any data
+	const unsigned char *entries = _data + _index_offset + _chunk_count * bundle_chunk_size;
+	uint64_t strings_size = _size - bundle_trailer_size - _strings_offset;
+
+	for (uint32_t i = 0; i < _entry_count; i++) {
+		const unsigned char *record = entries + i * bundle_entry_size;
+		uint32_t mode = static_cast<uint32_t>(bundle_read(record + 20, 4));
+
+		if (bundle_read(record + 8, 4) + bundle_read(record + 12, 4) > strings_size ||
+			bundle_read(record + 48, 4) + bundle_read(record + 52, 4) > strings_size ||
+			((mode & AE_IFMT) == AE_IFREG && bundle_read(record + 16, 4) >= _chunk_count &&
+			bundle_read(record + 32, 8) != 0)) {
+			fmt::print("Invalid template bundle entry {0:d}: {1:s}\n", i, _path);
+			return false;
+		}
+	}
+
+	// Like the entries of tar archives, no entry may be written outside the project or through a symlink
+	unordered_set<string> links;
+
+	for (uint32_t i = 0; i < _entry_count; i++) {
+		TemplateBundleEntry e = entry(i);
+
+		if ((e.mode & AE_IFMT) == AE_IFLNK) {
+			links.insert(file_path(e.path).lexically_normal().generic_string());
+		}
+	}
+	for (uint32_t i = 0; i < _entry_count; i++) {
+		TemplateBundleEntry e = entry(i);
+
+		if (!SystemPaths::is_contained(file_path(e.path).lexically_normal()) ||
+			((e.mode & AE_IFMT) == AE_IFLNK && !SystemPaths::is_contained_link(e.path, e.link)) ||
+			SystemPaths::is_linked(e.path, links)) {
+			fmt::print("Refusing template bundle entry outside the project: {0:s}\n", e.path);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Returns the number of entries in the bundle.
+*/
+size_t TemplateBundle::size()
+{
+	return _entry_count;
+}
+
+/*
+ * Returns an entry of the bundle by its index.
+ *
+ * The string ranges of the entries were checked when the bundle was opened.
+*/
+TemplateBundleEntry TemplateBundle::entry(size_t index)
+{
+	const unsigned char *record = _data + _index_offset + _chunk_count * bundle_chunk_size +
+		index * bundle_entry_size;
+	const char *strings = reinterpret_cast<const char*>(_data + _strings_offset);
+	TemplateBundleEntry result;
+
+	if (index >= _entry_count) {
+		return result;
+	}
+
+	result.path = string(strings + bundle_read(record + 8, 4), bundle_read(record + 12, 4));
+	result.chunk = static_cast<uint32_t>(bundle_read(record + 16, 4));
+	result.mode = static_cast<uint32_t>(bundle_read(record + 20, 4));
+	result.offset = bundle_read(record + 24, 8);
+	result.size = bundle_read(record + 32, 8);
+	result.mtime = static_cast<int64_t>(bundle_read(record + 40, 8));
+	result.link = string(strings + bundle_read(record + 48, 4), bundle_read(record + 52, 4));
+	return result;
+}
+
+/*
+ * Look up an entry by its path in constant time.
+ *
+ * Returns false if the bundle doesn't contain the entry.
+*/
+bool TemplateBundle::find(const string &pathname, TemplateBundleEntry &entry)
+{
+	const unsigned char *entries = _data + _index_offset + _chunk_count * bundle_chunk_size;
+	const unsigned char *buckets = entries + _entry_count * bundle_entry_size;
+	uint64_t hash = bundle_hash(pathname);
+
+	if (_bucket_count == 0) {
+		return false;
+	}
+
+	uint64_t i = hash % _bucket_count;
+
+	// A full table without a match ends after a single pass
+	for (uint32_t step = 0; step < _bucket_count; step++, i = (i + 1) % _bucket_count) {
+		uint32_t index = static_cast<uint32_t>(bundle_read(buckets + i * 4, 4));
+
+		if (index == 0 || index > _entry_count) {
+			return false;
+		}
+		if (bundle_read(entries + (index - 1) * bundle_entry_size, 8) != hash) {
+			continue;
+		}
+
+		entry = this->entry(index - 1);
+
+		if (entry.path == pathname) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Read the data of a regular file entry.
+ *
+ * Only the chunks containing the entry are decompressed.
+*/
+bool TemplateBundle::read(const TemplateBundleEntry &entry, vector<char> &data)
+{
+	vector<char> chunk;
+
+	if ((entry.mode & AE_IFMT) == AE_IFREG && spans(entry)) {
+		data.clear();
+		data.reserve(static_cast<size_t>(entry.size));
+		return read_span(entry, [&](const char *block, size_t size, uint64_t) {
+			data.insert(data.end(), block, block + size);
+			return true;
+		});
+	}
+	if ((entry.mode & AE_IFMT) != AE_IFREG || entry.chunk >= _chunk_count || !decompress(entry.chunk, chunk) ||
+		entry.offset > chunk.size() || entry.size > chunk.size() - entry.offset) {
+		return false;
+	}
+
+	data.assign(chunk.begin() + entry.offset, chunk.begin() + entry.offset + entry.size);
+	return true;
+}
+
+/*
+ * Extract the bundle to a specified destination.
+ *
+ * Directories and symlinks are created first, then the chunks are decompressed
+ * and written in parallel. Files spanning several chunks are written last, one chunk
+ * at a time, so memory use stays bounded by the chunk size. In update mode, files are only written if they are new
+ * or unmodified by the user. Chunks that only contain excluded files are never decompressed.
+ * File metadata is restored according to the metadata policy.
+*/
+bool TemplateBundle::extract(const file_path &dest, ProjectManifest &manifest, bool update, TemplateFilter &filter,
+	const TemplateDigests &digests, unsigned threads)
+{
+	if (_data == nullptr && !open()) {
+		return false;
+	}
+
+	vector<vector<uint32_t>> chunk_entries(_chunk_count);
+	vector<uint32_t> spanning;
+	vector<TemplateBundleEntry> directories;
+	atomic<uint32_t> next_chunk{0};
+	atomic<bool> failed{false};
+	mutex manifest_mutex;
+	vector<thread> workers;
+	error_code error;
+	for (uint32_t i = 0; i < _entry_count; i++) {
+		TemplateBundleEntry e = entry(i);
+		file_path target = dest.string() + separator + e.path;
+
+		if (!filter.claim(e.path)) {
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping excluded file: {0:s}\n", e.path);
+			}
+
+			continue;
+		}
+		if ((e.mode & AE_IFMT) == AE_IFREG && spans(e)) {
+			spanning.push_back(i);
+		} else if ((e.mode & AE_IFMT) == AE_IFREG && e.chunk < _chunk_count) {
+			chunk_entries[e.chunk].push_back(i);
+		} else if ((e.mode & AE_IFMT) == AE_IFREG) {
+			if (!write(e, "", dest, manifest, update, digests, manifest_mutex)) {
+				return false;
+			}
+		} else if ((e.mode & AE_IFMT) == AE_IFDIR) {
+			if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+				fmt::print("Writing file: {0:s}\n", e.path);
+			}
+
+			filesystem::create_directories(target, error);
+
+			if (_metadata != TemplateMetadataPolicy::minimal) {
+				directories.push_back(e);
+			}
+		} else if ((e.mode & AE_IFMT) == AE_IFLNK) {
+			if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+				fmt::print("Writing file: {0:s}\n", e.path);
+			}
+
+			filesystem::create_directories(target.parent_path(), error);
+			filesystem::remove(target, error);
+			filesystem::create_symlink(e.link, target, error);
+
+			if (error) {
+				fmt::print("Cannot create symlink {0:s}: {1:s}\n", e.path, error.message());
+				return false;
+			}
+		}
+	}
+
+	threads = (threads > 0) ? threads : std::max(thread::hardware_concurrency(), 1u);
+	threads = std::max(std::min(threads, _chunk_count), 1u);
+
+	for (unsigned t = 0; t < threads; t++) {
+		workers.emplace_back([&]() {
+			vector<char> data;
+
+			for (uint32_t c = next_chunk++; c < _chunk_count && !failed; c = next_chunk++) {
+				if (chunk_entries[c].empty()) {
+					continue;
+				}
+				if (!decompress(c, data)) {
+					fmt::print("Cannot decompress chunk {0:d} of {1:s}\n", c, _path);
+					failed = true;
+					return;
+				}
+				for (uint32_t index : chunk_entries[c]) {
+					TemplateBundleEntry e = entry(index);
+
+					if (e.offset > data.size() || e.size > data.size() - e.offset ||
+						!write(e, data.data() + e.offset, dest, manifest, update, digests, manifest_mutex)) {
+						failed = true;
+						return;
+					}
+				}
+			}
+		});
+	}
+	for (thread &worker : workers) {
+		worker.join();
+	}
+	if (!failed) {
+		SystemRuntime::parallel(spanning.size(), threads, [&](size_t i) {
+			if (!failed && !write_large(entry(spanning[i]), dest, manifest, update, digests, manifest_mutex)) {
+				failed = true;
+			}
+		});
+	}
+
+	// Directory metadata is applied last (and deepest first) so it isn't changed by their contents
+	for (auto it = directories.rbegin(); it != directories.rend(); it++) {
+		file_path target = dest.string() + separator + it->path;
+		TemplateMetadata::apply(target, it->mode, static_cast<time_t>(it->mtime), _metadata);
+	}
+
+	return !failed;
+}
+
+/*
+ * Stream the bundle into an archive.
+ *
+ * Entries are added in the order of their chunks, so every chunk is only decompressed once,
+ * apart from the last chunk of a file spanning several chunks. Chunks that only contain
+ * excluded files are never decompressed.
+*/
+bool TemplateBundle::stream(ProjectStream &stream, TemplateFilter &filter, const TemplateDigests &digests)
+{
+	if (_data == nullptr && !open()) {
+		return false;
+	}
+
+	vector<vector<uint32_t>> chunk_entries(_chunk_count);
+	vector<char> data;
+
+	for (uint32_t i = 0; i < _entry_count; i++) {
+		TemplateBundleEntry e = entry(i);
+
+		if (!filter.claim(e.path)) {
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping excluded file: {0:s}\n", e.path);
+			}
+
+			continue;
+		}
+		if ((e.mode & AE_IFMT) == AE_IFREG && e.chunk < _chunk_count) {
+			chunk_entries[e.chunk].push_back(i);
+			continue;
+		}
+		if ((e.mode & AE_IFMT) == AE_IFREG && !digests.empty()) {
+			HashDigest hash(digests.checksum(), digests.cryptographic());
+
+			if (!digests.check(e.path, hash)) {
+				return false;
+			}
+		}
+
+		struct archive_entry *item = ProjectStream::entry(e.path, e.mode, e.mtime, 0, e.link);
+		bool added = stream.add_entry(item);
+		archive_entry_free(item);
+
+		if (!added) {
+			return false;
+		}
+	}
+	for (uint32_t c = 0; c < _chunk_count; c++) {
+		bool decompressed = false;
+
+		for (uint32_t index : chunk_entries[c]) {
+			TemplateBundleEntry e = entry(index);
+
+			if (spans(e)) {
+				// Files spanning several chunks are added one chunk at a time
+				HashDigest hash(digests.checksum(), digests.cryptographic());
+				struct archive_entry *item = ProjectStream::entry(e.path, e.mode, e.mtime, e.size);
+				bool added = stream.add_entry(item) && read_span(e, [&](const char *block, size_t size, uint64_t) {
+					hash.update(block, size);
+					return stream.add_block(block, size);
+				});
+				archive_entry_free(item);
+
+				if (!added || (!digests.empty() && !digests.check(e.path, hash))) {
+					return false;
+				}
+
+				continue;
+			}
+			if (!decompressed && !decompress(c, data)) {
+				fmt::print("Cannot decompress chunk {0:d} of {1:s}\n", c, _path);
+				return false;
+			}
+
+			decompressed = true;
+
+			if (e.offset > data.size() || e.size > data.size() - e.offset) {
+				fmt::print("Cannot read {0:s} from {1:s}\n", e.path, _path);
+				return false;
+			}
+			if (!digests.empty()) {
+				HashDigest hash(digests.checksum(), digests.cryptographic());
+				hash.update(data.data() + e.offset, static_cast<size_t>(e.size));
+
+				if (!digests.check(e.path, hash)) {
+					return false;
+				}
+			}
+
+			struct archive_entry *item = ProjectStream::entry(e.path, e.mode, e.mtime, e.size);
+			bool added = stream.add_data(item, data.data() + e.offset);
+			archive_entry_free(item);
+
+			if (!added) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Convert a project.tar.xz into a template bundle.
+ *
+ * Files are packed into chunks of at most chunk_size bytes, files larger than
+ * the chunk size start a chunk of their own and continue over the following chunks.
+*/
+bool TemplateBundle::convert(const file_path &source, const file_path &dest, size_t chunk_size)
+{
+	struct archive *reader;
+	struct archive_entry *archive_entry;
+	file_path temp_path = dest.string() + ".tmp-" + to_string(steady_clock::now().time_since_epoch().count());
+	vector<TemplateBundleEntry> entries;
+	unordered_map<string, size_t> entry_paths;
+	unordered_set<string> links;
+	string chunks;
+	string strings;
+	vector<char> chunk;
+	vector<char> compressed;
+	uint64_t position = bundle_header_size;
+	error_code error;
+	int result;
+
+	chunk_size = std::max<size_t>(chunk_size, 1);
+	file_output stream(temp_path, std::ios::binary | std::ios::trunc);
+	string header = string(bundle_magic, 8);
+	bundle_write(header, bundle_version, 4);
+	bundle_write(header, 0, 4);
+	stream.write(header.data(), header.size());
+
+	// Remove the partially written bundle, so failed conversions leave nothing behind
+	auto discard = [&]() {
+		stream.close();
+		filesystem::remove(temp_path, error);
+		return false;
+	};
+
+	// Compress the current chunk and append it to the bundle
+	auto flush = [&]() {
+		if (chunk.empty()) {
+			return true;
+		}
+		if (!bundle_compress(chunk, compressed)) {
+			return false;
+		}
+
+		stream.write(compressed.data(), compressed.size());
+		bundle_write(chunks, position, 8);
+		bundle_write(chunks, compressed.size(), 8);
+		bundle_write(chunks, chunk.size(), 8);
+		position += compressed.size();
+		chunk.clear();
+		return true;
+	};
+
+	// Append data to the current chunk, full chunks are flushed so larger files continue in the next one.
+	// Zeros are appended without data, for the holes of sparse entries
+	auto append = [&](const char *data, uint64_t size) {
+		while (size > 0) {
+			size_t length = static_cast<size_t>(std::min<uint64_t>(size, chunk_size - chunk.size()));
+
+			if (data != nullptr) {
+				chunk.insert(chunk.end(), data, data + length);
+				data += length;
+			} else {
+				chunk.resize(chunk.size() + length);
+			}
+
+			size -= length;
+
+			if (chunk.size() >= chunk_size && !flush()) {
+				return false;
+			}
+		}
+
+		return true;
+	};
+
+	reader = archive_read_new();
+	archive_read_support_format_tar(reader);
+	archive_read_support_filter_xz(reader);
+	archive_read_support_filter_zstd(reader);
+	result = archive_read_open_filename(reader, source.string().c_str(), 10240);
+
+	if (result != ARCHIVE_OK || !stream.is_open()) {
+		fmt::print("Failed to read template data: {0:s}\n", source);
+		archive_read_free(reader);
+		return discard();
+	}
+	for (;;) {
+		result = archive_read_next_header(reader, &archive_entry);
+
+		if (result == ARCHIVE_EOF) {
+			break;
+		}
+		if (result < ARCHIVE_WARN) {
+			fmt::print("{0:s}\n", archive_error_string(reader));
+			archive_read_free(reader);
+			return discard();
+		}
+
+		TemplateBundleEntry e;
+		e.path = archive_entry_pathname(archive_entry);
+		e.mode = archive_entry_mode(archive_entry);
+		e.mtime = archive_entry_mtime(archive_entry);
+		e.chunk = bundle_no_chunk;
+
+		if (!SystemPaths::is_contained(file_path(e.path).lexically_normal()) ||
+			(archive_entry_filetype(archive_entry) == AE_IFLNK &&
+			!SystemPaths::is_contained_link(e.path, archive_entry_symlink(archive_entry)))) {
+			fmt::print("Skipping entry outside the project: {0:s}\n", e.path);
+			continue;
+		}
+		if (archive_entry_hardlink(archive_entry) != nullptr &&
+			entry_paths.count(archive_entry_hardlink(archive_entry))) {
+			// Hardlinks share the data of the file they point to
+			TemplateBundleEntry &target = entries[entry_paths[archive_entry_hardlink(archive_entry)]];
+			e.mode = AE_IFREG | (e.mode & 07777);
+			e.chunk = target.chunk;
+			e.offset = target.offset;
+			e.size = target.size;
+		} else if (archive_entry_filetype(archive_entry) == AE_IFLNK) {
+			e.link = archive_entry_symlink(archive_entry);
+			links.insert(file_path(e.path).lexically_normal().generic_string());
+		} else if (archive_entry_filetype(archive_entry) == AE_IFREG) {
+			uint64_t size = static_cast<uint64_t>(std::max<la_int64_t>(archive_entry_size(archive_entry), 0));
+			uint64_t position = 0;
+			const void *buffer;
+			la_int64_t offset;
+			size_t block_size;
+
+			if (!chunk.empty() && chunk.size() + size > chunk_size && !flush()) {
+				fmt::print("Cannot compress template bundle chunk\n");
+				archive_read_free(reader);
+				return discard();
+			}
+
+			e.chunk = static_cast<uint32_t>(chunks.size() / bundle_chunk_size);
+			e.offset = chunk.size();
+			e.size = size;
+
+			while ((result = archive_read_data_block(reader, &buffer, &block_size, &offset)) == ARCHIVE_OK) {
+				uint64_t hole = std::max<uint64_t>(static_cast<uint64_t>(offset), position) - position;
+
+				if (!append(nullptr, hole) || !append(static_cast<const char*>(buffer), block_size)) {
+					fmt::print("Cannot compress template bundle chunk\n");
+					archive_read_free(reader);
+					return discard();
+				}
+
+				position += hole + block_size;
+			}
+			if (result != ARCHIVE_EOF) {
+				fmt::print("{0:s}\n", archive_error_string(reader));
+				archive_read_free(reader);
+				return discard();
+			}
+			if (!append(nullptr, std::max(size, position) - position)) {
+				fmt::print("Cannot compress template bundle chunk\n");
+				archive_read_free(reader);
+				return discard();
+			}
+		} else if (archive_entry_filetype(archive_entry) != AE_IFDIR) {
+			fmt::print("Skipping unsupported entry: {0:s}\n", e.path);
+			continue;
+		}
+
+		entry_paths[e.path] = entries.size();
+		entries.push_back(e);
+	}
+
+	archive_read_free(reader);
+
+	if (!flush()) {
+		fmt::print("Cannot compress template bundle chunk\n");
+		return discard();
+	}
+
+	// Entries below a symlink would be written through it, the symlink may come after them in the archive
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const TemplateBundleEntry &e) {
+		if (!SystemPaths::is_linked(e.path, links)) {
+			return false;
+		}
+
+		fmt::print("Skipping entry outside the project: {0:s}\n", e.path);
+		return true;
+	}), entries.end());
+
+	// Build the index, the hash table is kept at most half full
+	uint32_t bucket_count = 1;
+	string records;
+	string trailer;
+
+	while (bucket_count < entries.size() * 2) {
+		bucket_count <<= 1;
+	}
+
+	vector<uint32_t> buckets(bucket_count, 0);
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		const TemplateBundleEntry &e = entries[i];
+		uint64_t hash = bundle_hash(e.path);
+		uint64_t bucket = hash % bucket_count;
+
+		while (buckets[bucket] != 0) {
+			bucket = (bucket + 1) % bucket_count;
+		}
+
+		buckets[bucket] = static_cast<uint32_t>(i + 1);
+		bundle_write(records, hash, 8);
+		bundle_write(records, strings.size(), 4);
+		bundle_write(records, e.path.size(), 4);
+		strings += e.path;
+		bundle_write(records, e.chunk, 4);
+		bundle_write(records, e.mode, 4);
+		bundle_write(records, e.offset, 8);
+		bundle_write(records, e.size, 8);
+		bundle_write(records, static_cast<uint64_t>(e.mtime), 8);
+		bundle_write(records, strings.size(), 4);
+		bundle_write(records, e.link.size(), 4);
+		strings += e.link;
+		bundle_write(records, 0, 8);
+	}
+	for (uint32_t bucket : buckets) {
+		bundle_write(records, bucket, 4);
+	}
+
+	uint64_t strings_offset = position + chunks.size() + records.size();
+	bundle_write(trailer, position, 8);
+	bundle_write(trailer, strings_offset, 8);
+	bundle_write(trailer, chunks.size() / bundle_chunk_size, 4);
+	bundle_write(trailer, entries.size(), 4);
+	bundle_write(trailer, bucket_count, 4);
+	bundle_write(trailer, 0, 4);
+	trailer += string(bundle_index_magic, 8);
+
+	stream.write(chunks.data(), chunks.size());
+	stream.write(records.data(), records.size());
+	stream.write(strings.data(), strings.size());
+	stream.write(trailer.data(), trailer.size());
+	stream.close();
+
+	if (!stream) {
+		fmt::print("Cannot write template bundle: {0:s}\n", dest);
+		return discard();
+	}
+
+	filesystem::rename(temp_path, dest, error);
+
+	if (error) {
+		fmt::print("Cannot write template bundle {0:s}: {1:s}\n", dest, error.message());
+		return discard();
+	}
+
+	fmt::print("Converted {0:d} entries into {1:d} chunks: {2:s}\n", entries.size(),
+		chunks.size() / bundle_chunk_size, dest);
+	return true;
+}
+
+/*
+ * Internally used by the read and extract functions
+*/
+bool TemplateBundle::decompress(uint32_t chunk, vector<char> &data)
+{
+	if (chunk >= _chunk_count) {
+		return false;
+	}
+
+	const unsigned char *record = _data + _index_offset + chunk * bundle_chunk_size;
+	uint64_t offset = bundle_read(record, 8);
+	uint64_t compressed_size = bundle_read(record + 8, 8);
+	uint64_t size = bundle_read(record + 16, 8);
+	struct archive *reader;
+	struct archive_entry *entry;
+	size_t position = 0;
+	int result;
+
+	if (compressed_size > _index_offset || offset > _index_offset - compressed_size) {
+		return false;
+	}
+
+	data.resize(static_cast<size_t>(size));
+	reader = archive_read_new();
+	archive_read_support_format_raw(reader);
+	archive_read_support_filter_xz(reader);
+	archive_read_support_filter_zstd(reader);
+	result = archive_read_open_memory(reader, _data + offset, static_cast<size_t>(compressed_size));
+
+	if (result == ARCHIVE_OK) {
+		result = archive_read_next_header(reader, &entry);
+	}
+	while (result == ARCHIVE_OK && position < data.size()) {
+		la_ssize_t count = archive_read_data(reader, data.data() + position, data.size() - position);
+
+		if (count <= 0) {
+			result = ARCHIVE_FATAL;
+			break;
+		}
+
+		position += static_cast<size_t>(count);
+	}
+
+	archive_read_free(reader);
+	return result == ARCHIVE_OK && position == data.size();
+}
+
+/*
+ * Internally used by the read, extract and stream functions
+ *
+ * Returns true if the data of a regular file continues past the end of its first chunk.
+*/
+bool TemplateBundle::spans(const TemplateBundleEntry &entry)
+{
+	if (entry.chunk >= _chunk_count) {
+		return false;
+	}
+
+	uint64_t size = bundle_read(_data + _index_offset + entry.chunk * bundle_chunk_size + 16, 8);
+	return entry.offset <= size && entry.size > size - entry.offset;
+}
+
+/*
+ * Internally used for files spanning several chunks
+ *
+ * The chunks are decompressed one at a time, every block of the file
+ * is passed with its offset in the file.
+*/
+bool TemplateBundle::read_span(const TemplateBundleEntry &entry,
+	const function<bool, const char*, size_t, uint64_t> &block)
+{
+	vector<char> data;
+	uint64_t offset = entry.offset;
+	uint64_t position = 0;
+
+	for (uint32_t c = entry.chunk; position < entry.size; c++) {
+		if (!decompress(c, data)) {
+			fmt::print("Cannot decompress chunk {0:d} of {1:s}\n", c, _path);
+			return false;
+		}
+		if (offset >= data.size()) {
+			fmt::print("Cannot read {0:s} from {1:s}\n", entry.path, _path);
+			return false;
+		}
+
+		size_t size = static_cast<size_t>(std::min<uint64_t>(data.size() - offset, entry.size - position));
+
+		if (!block(data.data() + offset, size, position)) {
+			return false;
+		}
+
+		position += size;
+		offset = 0;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the write functions
+ *
+ * Returns true if the file is to be written. In update mode, unchanged files
+ * are only recorded and files modified by the user are kept.
+*/
+bool TemplateBundle::admit(const TemplateBundleEntry &entry, const string &digest, ProjectManifest &manifest,
+	bool update, mutex &manifest_mutex)
+{
+	ProjectManifestStatus status = ProjectManifestStatus::created;
+
+	if (update) {
+		lock_guard lock(manifest_mutex);
+		status = manifest.compare(entry.path, digest);
+	}
+
+	switch (status) {
+	case ProjectManifestStatus::unchanged: {
+		lock_guard lock(manifest_mutex);
+		manifest.record(entry.path, digest);
+		return false;
+	}
+	case ProjectManifestStatus::modified:
+		fmt::print("Keeping modified file: {0:s}\n", entry.path);
+		return false;
+	case ProjectManifestStatus::conflict:
+		fmt::print("Conflict: {0:s} was modified locally, keeping local changes\n", entry.path);
+		return false;
+	case ProjectManifestStatus::updated:
+		if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+			fmt::print("Updating file: {0:s}\n", entry.path);
+		}
+		break;
+	case ProjectManifestStatus::created:
+		if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+			fmt::print("Writing file: {0:s}\n", entry.path);
+		}
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the extract function
+ *
+ * The decompressed data is checked against the template's digests before anything is written.
+*/
+bool TemplateBundle::write(const TemplateBundleEntry &entry, const char *data, const file_path &dest,
+	ProjectManifest &manifest, bool update, const TemplateDigests &digests, mutex &manifest_mutex)
+{
+	file_path target = dest.string() + separator + entry.path;
+	HashDigest hash(true, digests.cryptographic());
+	error_code error;
+
+	hash.update(data, static_cast<size_t>(entry.size));
+	string digest = hash.xxh3();
+
+	if (!digests.check(entry.path, hash)) {
+		return false;
+	}
+	if (!admit(entry, digest, manifest, update, manifest_mutex)) {
+		return true;
+	}
+
+	filesystem::create_directories(target.parent_path(), error);
+	filesystem::remove(target, error);
+	file_output stream(target, std::ios::binary | std::ios::trunc);
+	stream.write(data, static_cast<std::streamsize>(entry.size));
+	stream.close();
+
+	if (!stream) {
+		fmt::print("Cannot write file: {0:s}\n", target);
+		return false;
+	}
+
+	TemplateMetadata::apply(target, entry.mode, static_cast<time_t>(entry.mtime), _metadata);
+
+	lock_guard lock(manifest_mutex);
+	manifest.record(entry.path, digest);
+	return true;
+}
+
+/*
+ * Internally used by the extract function for files spanning several chunks
+ *
+ * The file is written to a temporary file one chunk at a time, it's only moved
+ * into place once it matched the template's digests.
+*/
+bool TemplateBundle::write_large(const TemplateBundleEntry &entry, const file_path &dest, ProjectManifest &manifest,
+	bool update, const TemplateDigests &digests, mutex &manifest_mutex)
+{
+	file_path target = dest.string() + separator + entry.path;
+	string temp_path = target.string() + ".proyekgen-tmp";
+	ProjectLargeFile file(temp_path, _metadata);
+	HashDigest hash(true, digests.cryptographic());
+	error_code error;
+
+	bool written = file.open(entry.size, entry.mode, false) &&
+		read_span(entry, [&](const char *block, size_t size, uint64_t offset) {
+			hash.update(block, size);
+			return file.write(block, size, offset);
+		}) && file.close(entry.mode, entry.mtime);
+	string digest = hash.xxh3();
+
+	if (!written || !digests.check(entry.path, hash)) {
+		filesystem::remove(temp_path, error);
+		return false;
+	}
+	if (!admit(entry, digest, manifest, update, manifest_mutex)) {
+		filesystem::remove(temp_path, error);
+		return true;
+	}
+
+	filesystem::rename(temp_path, target, error);
+
+	if (error) {
+		fmt::print("Cannot write file {0:s}: {1:s}\n", target, error.message());
+		filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	lock_guard lock(manifest_mutex);
+	manifest.record(entry.path, digest);
+	return true;
+}
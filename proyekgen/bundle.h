@@ -0,0 +1,100 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "filter.h"
+#include "digest.h"
+#include "hash.h"
+#include "large.h"
+#include "manifest.h"
+#include "metadata.h"
+#include "stream.h"
+#include "system.h"
+
+/*
+ * An entry of a template bundle.
+ *
+ * The mode includes the file type bits (AE_IFREG, AE_IFDIR, AE_IFLNK),
+ * the data of regular files starts at an offset of a chunk. Files larger
+ * than a chunk continue at the start of the following chunks.
+*/
+struct TemplateBundleEntry
+{
+	string path;
+	string link;
+	uint32_t chunk = 0;
+	uint32_t mode = 0;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	int64_t mtime = 0;
+};
+
+/*
+ * An indexed single-file template bundle (project.pgb).
+ *
+ * File data is packed into independently xz-compressed chunks, followed by a
+ * trailing index with a hash table of the entry paths. The bundle is memory-mapped,
+ * any entry can be looked up without decompressing the whole project data
+ * and chunks can be extracted in parallel.
+*/
+class TemplateBundle
+{
+public:
+	TemplateBundle(const file_path &path);
+	~TemplateBundle();
+	TemplateBundle(const TemplateBundle &) = delete;
+	TemplateBundle &operator=(const TemplateBundle &) = delete;
+
+	file_path path();
+	bool outdated();
+	void set_metadata(TemplateMetadataPolicy metadata);
+	bool open();
+	size_t size();
+	TemplateBundleEntry entry(size_t index);
+	bool find(const string &pathname, TemplateBundleEntry &entry);
+	bool read(const TemplateBundleEntry &entry, vector<char> &data);
+	bool extract(const file_path &dest, ProjectManifest &manifest, bool update, TemplateFilter &filter,
+		const TemplateDigests &digests, unsigned threads = 0);
+	bool stream(ProjectStream &stream, TemplateFilter &filter, const TemplateDigests &digests);
+	static bool convert(const file_path &source, const file_path &dest, size_t chunk_size = 1 << 20);
+
+	static const string bundle_name;
+
+private:
+	bool decompress(uint32_t chunk, vector<char> &data);
+	bool spans(const TemplateBundleEntry &entry);
+	bool read_span(const TemplateBundleEntry &entry, const function<bool, const char*, size_t, uint64_t> &block);
+	bool admit(const TemplateBundleEntry &entry, const string &digest, ProjectManifest &manifest, bool update,
+		mutex &manifest_mutex);
+	bool write(const TemplateBundleEntry &entry, const char *data, const file_path &dest,
+		ProjectManifest &manifest, bool update, const TemplateDigests &digests, mutex &manifest_mutex);
+	bool write_large(const TemplateBundleEntry &entry, const file_path &dest, ProjectManifest &manifest, bool update,
+		const TemplateDigests &digests, mutex &manifest_mutex);
+
+	file_path _path;
+	TemplateMetadataPolicy _metadata = TemplateMetadataPolicy::full;
+	const unsigned char *_data = nullptr;
+	size_t _size = 0;
+	vector<unsigned char> _buffer;
+	uint64_t _index_offset = 0;
+	uint64_t _strings_offset = 0;
+	uint32_t _chunk_count = 0;
+	uint32_t _entry_count = 0;
+	uint32_t _bucket_count = 0;
+};
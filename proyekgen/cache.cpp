@@ -0,0 +1,680 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "cache.h"
+
+// Leftovers of writers without a lock file are only removed after this long, they might still be publishing
+const std::chrono::minutes SharedCache::grace_period = std::chrono::minutes(10);
+
+SharedCache::SharedCache(const file_path &path)
+	: _path(path)
+{}
+
+SharedCache::SharedCache()
+{}
+
+/*
+ * Returns the default root path of the cache.
+*/
+file_path SharedCache::default_path()
+{
+	return (SystemRuntime::is_root() ? SystemBasePaths::global_data_path() :
+		SystemBasePaths::local_data_path()).string() + separator + "cache";
+}
+
+/*
+ * Returns the root path of the cache.
+*/
+file_path SharedCache::path()
+{
+	return _path;
+}
+
+/*
+ * Set the size limit of the cache in bytes, zero means unlimited.
+ *
+ * The least recently used entries are evicted by the maintenance after publishing an entry.
+*/
+void SharedCache::set_limit(uintmax_t limit)
+{
+	_limit = limit;
+}
+
+/*
+ * Read the current generation of an entry without taking any locks.
+ *
+ * The reader function receives the entry directory and returns false if the entry is unusable.
+ * Returns false on a miss, or if the entry was evicted while it was being read.
+*/
+bool SharedCache::read(const string &key, const function<bool, const file_path&> &reader)
+{
+	file_path index_path = _path.string() + separator + "index" + separator + key;
+	string generation;
+	uintmax_t entry_size;
+	error_code error;
+
+	if (!entry(key, generation, entry_size)) {
+		return false;
+	}
+
+	file_path object_path = _path.string() + separator + "objects" + separator + key + "." + generation;
+
+	if (!filesystem::is_directory(object_path) || !reader(object_path)) {
+		return false;
+	}
+	if (!filesystem::is_directory(object_path)) {
+		// Evicted entries are moved away first and generations are never reused,
+		// so an entry that's still in place wasn't changed while it was read
+		return false;
+	}
+
+	// Mark the entry as recently used
+	filesystem::last_write_time(index_path, filesystem::file_time_type::clock::now(), error);
+	return true;
+}
+
+/*
+ * Returns a new temporary directory for writing an entry, which is then published or discarded.
+ *
+ * The lock file of the directory is held until then, so maintenance never removes it while it's written.
+ * An empty path is returned if the directory cannot be created.
+*/
+file_path SharedCache::stage()
+{
+	file_path staged = _path.string() + separator + "tmp" + separator + unique_name();
+	error_code error;
+
+	filesystem::create_directories(staged.parent_path(), error);
+
+#if !defined(_WIN32)
+	int fd = open((staged.string() + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		filesystem::remove(staged.string() + ".lock", error);
+		return file_path();
+	}
+
+	_locks[staged.string()] = fd;
+#endif
+
+	filesystem::create_directories(staged, error);
+
+	if (error) {
+		release(staged);
+		return file_path();
+	}
+
+	return staged;
+}
+
+/*
+ * Publish a staged directory as the new generation of an entry.
+ *
+ * The directory is renamed into place first, then the index of the key is replaced
+ * through a temporary file, readers see either the previous or the new generation.
+*/
+bool SharedCache::publish(const string &key, const file_path &staged)
+{
+	string generation = unique_name();
+	file_path object_path = _path.string() + separator + "objects" + separator + key + "." + generation;
+	file_path index_path = _path.string() + separator + "index" + separator + key;
+	file_path temp_path = _path.string() + separator + "tmp" + separator + unique_name() + ".index";
+	uintmax_t entry_size = size(staged);
+	error_code error;
+
+	filesystem::create_directories(object_path.parent_path(), error);
+	filesystem::create_directories(index_path.parent_path(), error);
+	filesystem::rename(staged, object_path, error);
+
+	if (error) {
+		discard(staged);
+		return false;
+	}
+
+	release(staged);
+
+	file_output stream(temp_path);
+	stream << generation << " " << entry_size << "\n";
+	stream.close();
+
+	if (stream) {
+		filesystem::rename(temp_path, index_path, error);
+	}
+	if (!stream || error) {
+		filesystem::remove(temp_path, error);
+		remove(object_path);
+		return false;
+	}
+
+	maintain();
+	return true;
+}
+
+/*
+ * Remove a staged directory that won't be published.
+*/
+void SharedCache::discard(const file_path &staged)
+{
+	error_code error;
+	filesystem::remove_all(staged, error);
+	release(staged);
+}
+
+/*
+ * Evict the least recently used entries past the size limit and remove leftovers.
+ *
+ * Maintenance is skipped if another process holds the lock, it runs again after the next publish.
+ * Evicted entries are unindexed first and then moved away, so readers never use a partial entry.
+*/
+void SharedCache::maintain()
+{
+	file_path index_path = _path.string() + separator + "index";
+	file_path objects_path = _path.string() + separator + "objects";
+	filesystem::file_time_type now = filesystem::file_time_type::clock::now();
+	vector<pair<filesystem::file_time_type, string>> entries;
+	unordered_map<string, uintmax_t> sizes;
+	unordered_set<string> indexed;
+	uintmax_t total_size = 0;
+	error_code error;
+
+#if !defined(_WIN32)
+	int fd = open((_path.string() + separator + "lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+
+		return;
+	}
+#endif
+
+	for (const dir_entry &e : filesystem::directory_iterator{ index_path, error }) {
+		string key = e.path().filename().string();
+		string generation;
+		uintmax_t entry_size;
+
+		if (!entry(key, generation, entry_size)) {
+			continue;
+		}
+
+		indexed.insert(key + "." + generation);
+		entries.push_back({e.last_write_time(error), key + "." + generation});
+		sizes[key + "." + generation] = entry_size;
+		total_size += entry_size;
+	}
+
+	// Superseded generations and leftovers of interrupted writers
+	for (const dir_entry &e : filesystem::directory_iterator{ objects_path, error }) {
+		if (!indexed.count(e.path().filename().string()) && now - e.last_write_time(error) > grace_period) {
+			remove(e.path());
+		}
+	}
+	for (const dir_entry &e : filesystem::directory_iterator{ _path.string() + separator + "tmp", error }) {
+		string name = e.path().string();
+		bool lock_file = e.path().extension() == ".lock";
+		file_path staged = lock_file ? name.substr(0, name.size() - 5) : name;
+
+		// Lock files are removed together with their staged directory
+		if (lock_file && filesystem::exists(staged, error)) {
+			continue;
+		}
+		if (abandoned(staged, now)) {
+			remove(e.path());
+			filesystem::remove(staged.string() + ".lock", error);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end());
+
+	for (const pair<filesystem::file_time_type, string> &e : entries) {
+		if (_limit == 0 || total_size <= _limit) {
+			break;
+		}
+
+		string key = e.second.substr(0, e.second.rfind('.'));
+		string generation;
+		uintmax_t entry_size;
+
+		// A writer might have published a newer generation since the index was listed
+		if (entry(key, generation, entry_size) && key + "." + generation == e.second) {
+			filesystem::remove(index_path.string() + separator + key, error);
+		}
+
+		remove(objects_path.string() + separator + e.second);
+		total_size -= std::min(sizes[e.second], total_size);
+	}
+
+#if !defined(_WIN32)
+	close(fd);
+#endif
+}
+
+/*
+ * Internally used by the maintain function
+ *
+ * A staged directory is abandoned once nobody holds its lock file anymore,
+ * temporary files and directories without a lock file are abandoned after the grace period.
+*/
+bool SharedCache::abandoned(const file_path &staged, filesystem::file_time_type now)
+{
+	error_code error;
+
+#if !defined(_WIN32)
+	int fd = open((staged.string() + ".lock").c_str(), O_RDWR | O_CLOEXEC);
+
+	if (fd >= 0) {
+		bool unlocked = flock(fd, LOCK_EX | LOCK_NB) == 0;
+		close(fd);
+		return unlocked;
+	}
+#endif
+
+	filesystem::file_time_type time = filesystem::last_write_time(staged, error);
+	return !error && now - time > grace_period;
+}
+
+/*
+ * Internally used by the stage, publish and discard functions
+ *
+ * The lock file is removed before it's unlocked, so it's never reused by another writer.
+*/
+void SharedCache::release(const file_path &staged)
+{
+#if !defined(_WIN32)
+	error_code error;
+	auto lock = _locks.find(staged.string());
+
+	if (lock == _locks.end()) {
+		return;
+	}
+
+	filesystem::remove(staged.string() + ".lock", error);
+	close(lock->second);
+	_locks.erase(lock);
+#endif
+}
+
+/*
+ * Internally used by the read and maintain functions
+ *
+ * Reads the current generation of an entry and its size from the index.
+*/
+bool SharedCache::entry(const string &key, string &generation, uintmax_t &size)
+{
+	file_input stream(_path.string() + separator + "index" + separator + key);
+	stream >> generation >> size;
+	return static_cast<bool>(stream) && !generation.empty();
+}
+
+/*
+ * Internally used by the publish and maintain functions
+ *
+ * Directories are moved out of place before they're deleted, so they disappear at once.
+*/
+void SharedCache::remove(const file_path &path)
+{
+	file_path trash_path = _path.string() + separator + "trash" + separator + unique_name();
+	error_code error;
+
+	filesystem::create_directories(trash_path.parent_path(), error);
+	filesystem::rename(path, trash_path, error);
+	filesystem::remove_all(error ? path : trash_path, error);
+}
+
+/*
+ * Internally used by the publish function
+*/
+uintmax_t SharedCache::size(const file_path &path)
+{
+	uintmax_t result = 0;
+	error_code error;
+
+	for (const dir_entry &e : filesystem::recursive_directory_iterator{ path, error }) {
+		if (e.is_regular_file(error)) {
+			result += e.file_size(error);
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Returns a name that is unique between threads and processes, used for generations and temporary files.
+*/
+string SharedCache::unique_name()
+{
+	static atomic<unsigned> counter{0};
+#if defined(_WIN32)
+	unsigned long pid = GetCurrentProcessId();
+#else
+	unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+
+	return fmt::format("{0:x}-{1:d}-{2:d}", std::chrono::system_clock::now().time_since_epoch().count(),
+		pid, counter++);
+}
+
+RunnerCache::RunnerCache(const file_path &path)
+	: _cache(path)
+{}
+
+RunnerCache::RunnerCache()
+{}
+
+/*
+ * Returns the path where runner outputs are cached.
+*/
+file_path RunnerCache::path()
+{
+	return _cache.path();
+}
+
+/*
+ * Set the size limit of the cache in bytes, zero means unlimited.
+ *
+ * The least recently used entries are evicted after storing an entry that exceeds the limit.
+*/
+void RunnerCache::set_limit(uintmax_t limit)
+{
+	_cache.set_limit(limit);
+}
+
+/*
+ * Execute a runner, or restore its outputs from the cache on a hit.
+ *
+ * Runners that don't declare their outputs are always executed.
+ * The runner is expected to be executed inside the output directory.
+*/
+void RunnerCache::run(const Template &t, TemplateRunner &runner, const file_path &output)
+{
+	string runner_name = runner.path().filename().string();
+
+	if (!runner.cacheable()) {
+		runner.execute();
+		return;
+	}
+
+	string runner_key = key(t, runner, output);
+
+	if (runner_key.empty()) {
+		fmt::print("Runner not cached: {0:s}\n", runner_name);
+		runner.execute();
+		return;
+	}
+	if (restore(runner_key, runner, output)) {
+		fmt::print("Runner cache hit: {0:s} ({1:s})\n", runner_name, runner_key.substr(0, 12));
+		return;
+	}
+
+	fmt::print("Runner cache miss: {0:s} ({1:s})\n", runner_name, runner_key.substr(0, 12));
+	runner.execute();
+
+	if (!store(runner_key, runner, output)) {
+		fmt::print("Cannot cache outputs of runner: {0:s}\n", runner_name);
+	}
+}
+
+/*
+ * Returns the cache key of a runner.
+ *
+ * The key is a hash of the runner script, its declared input files
+ * (relative to the output directory), environment variables, template variables
+ * and outputs. The "output" variable resolves to the output directory.
+ * An empty key is returned if an input isn't contained in the output directory or cannot be read.
+*/
+string RunnerCache::key(const Template &t, TemplateRunner &runner, const file_path &output)
+{
+	const TemplateRunnerInputs &inputs = runner.inputs();
+	HashSha256 hash;
+
+	hash.update("proyekgen-runner-cache-v1\n");
+	hash.update("runner:" + runner.digest() + "\n");
+
+	for (const string &file : inputs.files) {
+		if (!SystemPaths::is_contained(file_path(file).lexically_normal())) {
+			fmt::print("Runner input must be a relative path inside the project: {0:s}\n", file);
+			return string();
+		}
+
+		hash.update("file:" + file + "\n");
+
+		if (!hash_path(hash, output.string() + separator + file, file)) {
+			return string();
+		}
+	}
+	for (const string &name : inputs.env) {
+		const char *value = getenv(name.c_str());
+		hash.update("env:" + name + ((value != nullptr) ? "=" + string(value) : " unset") + "\n");
+	}
+	for (const string &name : inputs.variables) {
+		string value = (name == "output") ? output.string() : t.variable(name);
+		hash.update("variable:" + name + "=" + value + "\n");
+	}
+	for (const file_path &o : runner.outputs()) {
+		hash.update("output:" + o.generic_string() + "\n");
+	}
+
+	return hash.finish();
+}
+
+/*
+ * Restore the cached outputs of a runner into the output directory.
+ *
+ * The outputs are copied into a staging directory first, then moved into place.
+ * Outputs that were already moved are rolled back if moving one fails, so a failed
+ * restore leaves the output directory as it was. Returns false on a cache miss.
+*/
+bool RunnerCache::restore(const string &key, TemplateRunner &runner, const file_path &output)
+{
+	file_path staging = output.string() + separator + ".proyekgen-restore-" +
+		to_string(steady_clock::now().time_since_epoch().count());
+	vector<file_path> moved;
+	error_code status_error;
+	error_code error;
+
+	if (!valid_outputs(runner)) {
+		return false;
+	}
+
+	bool hit = _cache.read(key, [&](const file_path &entry_path) {
+		for (const file_path &o : runner.outputs()) {
+			if (!filesystem::exists(entry_path.string() + separator + o.string())) {
+				return false;
+			}
+		}
+		for (const file_path &o : runner.outputs()) {
+			file_path source = entry_path.string() + separator + o.string();
+			file_path destination = staging.string() + separator + "new" + separator + o.string();
+
+			filesystem::create_directories(destination.parent_path(), error);
+			filesystem::copy(source, destination, filesystem::copy_options::recursive |
+				filesystem::copy_options::copy_symlinks | filesystem::copy_options::overwrite_existing, error);
+
+			if (error) {
+				fmt::print("Cannot restore cached output {0:s}: {1:s}\n", o, error.message());
+				return false;
+			}
+		}
+
+		return true;
+	});
+
+	for (size_t i = 0; hit && i < runner.outputs().size(); i++) {
+		const file_path &o = runner.outputs()[i];
+		file_path destination = output.string() + separator + o.string();
+		file_path previous = staging.string() + separator + "old" + separator + o.string();
+
+		// Existing outputs are kept in the staging directory until every output is in place
+		filesystem::create_directories(previous.parent_path(), error);
+		filesystem::create_directories(destination.parent_path(), error);
+
+		if (filesystem::exists(filesystem::symlink_status(destination, status_error))) {
+			filesystem::rename(destination, previous, error);
+		}
+		if (!error) {
+			filesystem::rename(staging.string() + separator + "new" + separator + o.string(), destination, error);
+		}
+		if (error) {
+			fmt::print("Cannot restore cached output {0:s}: {1:s}\n", o, error.message());
+			hit = false;
+			break;
+		}
+
+		moved.push_back(o);
+	}
+	if (!hit) {
+		for (auto o = moved.rbegin(); o != moved.rend(); o++) {
+			file_path destination = output.string() + separator + o->string();
+			file_path previous = staging.string() + separator + "old" + separator + o->string();
+
+			filesystem::remove_all(destination, error);
+
+			if (filesystem::exists(filesystem::symlink_status(previous, status_error))) {
+				filesystem::rename(previous, destination, error);
+			}
+		}
+	}
+
+	filesystem::remove_all(staging, error);
+	return hit;
+}
+
+/*
+ * Store the declared outputs of a runner into the cache.
+ *
+ * Outputs that aren't contained in the output directory are never stored.
+*/
+bool RunnerCache::store(const string &key, TemplateRunner &runner, const file_path &output)
+{
+	if (!valid_outputs(runner)) {
+		return false;
+	}
+
+	file_path staged = _cache.stage();
+	error_code error;
+
+	if (staged.empty()) {
+		return false;
+	}
+	for (const file_path &o : runner.outputs()) {
+		file_path source = output.string() + separator + o.string();
+		file_path destination = staged.string() + separator + o.string();
+
+		if (!filesystem::exists(source)) {
+			fmt::print("Runner did not produce declared output: {0:s}\n", o);
+			_cache.discard(staged);
+			return false;
+		}
+
+		filesystem::create_directories(destination.parent_path(), error);
+		filesystem::copy(source, destination, filesystem::copy_options::recursive |
+			filesystem::copy_options::copy_symlinks, error);
+
+		if (error) {
+			_cache.discard(staged);
+			return false;
+		}
+	}
+
+	return _cache.publish(key, staged);
+}
+
+/*
+ * Internally used by the restore and store functions
+ *
+ * Returns false if a declared output isn't contained in the output directory.
+*/
+bool RunnerCache::valid_outputs(TemplateRunner &runner)
+{
+	for (const file_path &o : runner.outputs()) {
+		if (!SystemPaths::is_contained(o.lexically_normal())) {
+			fmt::print("Runner output must be a relative path inside the project: {0:s}\n", o);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the key function
+ *
+ * Missing inputs are hashed as missing, returns false if an input cannot be read.
+*/
+bool RunnerCache::hash_path(HashSha256 &hash, const file_path &path, const file_path &relative)
+{
+	error_code error;
+	filesystem::file_status status = filesystem::status(path, error);
+
+	if (error && status.type() != filesystem::file_type::not_found) {
+		fmt::print("Cannot read runner input {0:s}: {1:s}\n", relative, error.message());
+		return false;
+	}
+	if (filesystem::is_regular_file(status)) {
+		string digest = HashSha256::file(path);
+
+		if (digest.empty()) {
+			fmt::print("Cannot read runner input: {0:s}\n", relative);
+			return false;
+		}
+
+		hash.update(relative.generic_string() + ":" + digest + "\n");
+		return true;
+	}
+	if (!filesystem::is_directory(status)) {
+		hash.update(relative.generic_string() + ":missing\n");
+		return true;
+	}
+
+	// Directory inputs are hashed in a stable order regardless of the traversal order
+	vector<file_path> files;
+	filesystem::recursive_directory_iterator entry(path, error);
+
+	for (; !error && entry != filesystem::recursive_directory_iterator(); entry.increment(error)) {
+		error_code entry_error;
+
+		if (entry->is_regular_file(entry_error)) {
+			files.push_back(entry->path());
+		}
+	}
+	if (error) {
+		fmt::print("Cannot read runner input {0:s}: {1:s}\n", relative, error.message());
+		return false;
+	}
+
+	std::sort(files.begin(), files.end());
+
+	for (const file_path &file : files) {
+		file_path file_relative = relative.string() + separator + file.lexically_relative(path).string();
+		string digest = HashSha256::file(file);
+
+		if (digest.empty()) {
+			fmt::print("Cannot read runner input: {0:s}\n", file_relative);
+			return false;
+		}
+
+		hash.update(file_relative.generic_string() + ":" + digest + "\n");
+	}
+
+	return true;
+}
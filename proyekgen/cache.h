@@ -0,0 +1,91 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "hash.h"
+#include "system.h"
+#include "template.h"
+
+/*
+ * A cache directory shared by concurrent proyekgen processes.
+ *
+ * Entries are immutable directories published with a rename under a new generation,
+ * the index file of a key names its current generation and is replaced atomically.
+ * Readers never take locks, they only use an entry if it's still in place after reading it.
+ * Writers hold a lock file next to their staged directory until it's published or discarded.
+ * Maintenance (evicting the least recently used entries past the size limit and removing
+ * leftovers of interrupted writers) is serialized between processes with flock.
+*/
+class SharedCache
+{
+public:
+	SharedCache(const file_path &path);
+	SharedCache();
+
+	static file_path default_path();
+	file_path path();
+	void set_limit(uintmax_t limit);
+	bool read(const string &key, const function<bool, const file_path&> &reader);
+	file_path stage();
+	bool publish(const string &key, const file_path &staged);
+	void discard(const file_path &staged);
+	void maintain();
+
+private:
+	bool entry(const string &key, string &generation, uintmax_t &size);
+	bool abandoned(const file_path &staged, filesystem::file_time_type now);
+	void release(const file_path &staged);
+	void remove(const file_path &path);
+	static uintmax_t size(const file_path &path);
+	static string unique_name();
+
+	static const std::chrono::minutes grace_period;
+
+	file_path _path = default_path();
+	uintmax_t _limit = 0;
+	unordered_map<string, int> _locks;
+};
+
+/*
+ * A class that memoizes the outputs of runners.
+ *
+ * Runners that declare their inputs and outputs are keyed by a hash of
+ * the inputs, on a hit the outputs are restored instead of executing the runner.
+ * The outputs are kept in a shared cache, so concurrent runs can reuse them.
+*/
+class RunnerCache
+{
+public:
+	RunnerCache(const file_path &path);
+	RunnerCache();
+
+	static file_path default_path();
+	file_path path();
+	void set_limit(uintmax_t limit);
+	void run(const Template &t, TemplateRunner &runner, const file_path &output);
+	string key(const Template &t, TemplateRunner &runner, const file_path &output);
+	bool restore(const string &key, TemplateRunner &runner, const file_path &output);
+	bool store(const string &key, TemplateRunner &runner, const file_path &output);
+
+private:
+	bool valid_outputs(TemplateRunner &runner);
+	bool hash_path(HashSha256 &hash, const file_path &path, const file_path &relative);
+
+	SharedCache _cache = SharedCache(SharedCache::default_path().string() + separator + "runners");
+};
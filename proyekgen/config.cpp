@@ -0,0 +1,257 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+
+SystemConfig::SystemConfig(const vector<file_path> &paths)
+	: _paths(paths)
+{}
+
+SystemConfig::SystemConfig()
+{}
+
+/*
+ * Returns the number of worker threads, zero uses every available core.
+*/
+unsigned SystemConfig::threads()
+{
+	return _threads;
+}
+
+/*
+ * Returns the size of the blocks read from project data.
+*/
+size_t SystemConfig::block_size()
+{
+	return _block_size;
+}
+
+/*
+ * Returns the directory where cached data is stored.
+*/
+file_path SystemConfig::cache_path()
+{
+	return _cache_path;
+}
+
+/*
+ * Returns the size limit of the cache in bytes, zero means unlimited.
+*/
+uintmax_t SystemConfig::cache_size()
+{
+	return _cache_size;
+}
+
+/*
+ * Returns the preferred format of project data (manifest, bundle or tar),
+ * an empty string keeps the default order.
+*/
+string SystemConfig::archive_format()
+{
+	return _archive_format;
+}
+
+/*
+ * Returns the default durability policy of generated projects.
+*/
+string SystemConfig::durability()
+{
+	return _durability;
+}
+
+/*
+ * Returns the default progress verbosity (quiet, normal or verbose).
+*/
+string SystemConfig::verbosity()
+{
+	return _verbosity;
+}
+
+/*
+ * Returns the number of most used templates prewarmed when a project is generated, zero disables prewarming.
+*/
+unsigned SystemConfig::prewarm()
+{
+	return _prewarm;
+}
+
+/*
+ * Returns the size from which files are preallocated and written sparsely.
+*/
+uintmax_t SystemConfig::large_file_size()
+{
+	return _large_file_size;
+}
+
+/*
+ * Load the configuration.
+ *
+ * The files are only parsed (and the cache only written) if the cached result doesn't
+ * match their current sizes and modification times. Every set of configuration paths
+ * has a cache of its own, so projects with their own .proyekgen don't replace each other's.
+*/
+void SystemConfig::load()
+{
+	string paths;
+
+	for (const file_path &config_path : _paths) {
+		paths += config_path.string() + '\n';
+	}
+
+	file_path cache_file = SystemBasePaths::local_cache_path().string() + separator + "config-" +
+		HashSha256::text(paths).substr(0, 16) + ".json";
+	json current_signature = signature();
+	file_input cache_stream(cache_file);
+	json cache_json = json::parse(cache_stream, nullptr, false);
+	error_code error;
+
+	// Version 2 moved the default cache path into the data directory, version 3 added large_file_size
+	if (cache_json.is_object() && cache_json.value("version", 0) == 3 &&
+		cache_json.value("files", json()) == current_signature) {
+		set_values(cache_json.value("values", json::object()));
+		return;
+	}
+	for (const file_path &config_path : _paths) {
+		read(config_path.string() + separator + "init.cfg");
+	}
+
+	// Write the cache through a temporary file so concurrent runs never read a partial cache
+	file_path temp_file = cache_file.string() + ".tmp-" + to_string(steady_clock::now().time_since_epoch().count());
+	filesystem::create_directories(cache_file.parent_path(), error);
+	file_output temp_stream(temp_file);
+	temp_stream << json({{"version", 3}, {"files", current_signature}, {"values", values()}}).dump();
+	temp_stream.close();
+	filesystem::rename(temp_file, cache_file, error);
+
+	if (error) {
+		filesystem::remove(temp_file, error);
+	}
+
+	// The single cache of earlier versions is replaced by the caches per set of paths
+	filesystem::remove(cache_file.parent_path().string() + separator + "config.json", error);
+}
+
+/*
+ * Internally used by the load function
+ *
+ * Returns the paths, sizes and modification times of the configuration files.
+*/
+json SystemConfig::signature()
+{
+	json result = json::array();
+	error_code error;
+
+	for (const file_path &config_path : _paths) {
+		file_path config_file = config_path.string() + separator + "init.cfg";
+
+		if (!filesystem::is_regular_file(config_file, error)) {
+			result.push_back({{"path", config_file.string()}});
+			continue;
+		}
+
+		result.push_back({{"path", config_file.string()},
+			{"size", filesystem::file_size(config_file, error)},
+			{"mtime", filesystem::last_write_time(config_file, error).time_since_epoch().count()}});
+	}
+
+	return result;
+}
+
+/*
+ * Internally used by the load function
+*/
+json SystemConfig::values()
+{
+	return {{"threads", _threads}, {"block_size", _block_size}, {"cache_path", _cache_path.string()},
+		{"cache_size", _cache_size}, {"archive_format", _archive_format}, {"durability", _durability},
+		{"verbosity", _verbosity}, {"prewarm", _prewarm}, {"large_file_size", _large_file_size}};
+}
+
+/*
+ * Internally used by the load function
+*/
+void SystemConfig::set_values(const json &values)
+{
+	_threads = values.value("threads", _threads);
+	_block_size = values.value("block_size", _block_size);
+	_cache_path = values.value("cache_path", _cache_path.string());
+	_cache_size = values.value("cache_size", _cache_size);
+	_archive_format = values.value("archive_format", _archive_format);
+	_durability = values.value("durability", _durability);
+	_verbosity = values.value("verbosity", _verbosity);
+	_prewarm = values.value("prewarm", _prewarm);
+	_large_file_size = values.value("large_file_size", _large_file_size);
+}
+
+/*
+ * Internally used by the load function
+ *
+ * Settings that are missing from the file keep their current values.
+*/
+void SystemConfig::read(const file_path &path)
+{
+	config config_file;
+	long long number;
+	string text;
+
+	if (!filesystem::is_regular_file(path)) {
+		return;
+	}
+	try {
+		config_file.readFile(path.string().c_str());
+	} catch (libconfig::ParseException &ex) {
+		fmt::print("Cannot read configuration file {0:s} at line {1:d}: {2:s}\n",
+			ex.getFile(), ex.getLine(), ex.getError());
+		return;
+	} catch (libconfig::FileIOException &ex) {
+		fmt::print("Cannot read configuration file {0:s}\n", path);
+		return;
+	}
+
+	if (config_file.lookupValue("threads", number) && number >= 0) {
+		_threads = static_cast<unsigned>(number);
+	}
+	if (config_file.lookupValue("block_size", number) && number > 0) {
+		_block_size = static_cast<size_t>(number);
+	}
+	if (config_file.lookupValue("cache_size", number) && number >= 0) {
+		_cache_size = static_cast<uintmax_t>(number);
+	}
+	if (config_file.lookupValue("prewarm", number) && number >= 0) {
+		_prewarm = static_cast<unsigned>(number);
+	}
+	if (config_file.lookupValue("large_file_size", number) && number > 0) {
+		_large_file_size = static_cast<uintmax_t>(number);
+	}
+	if (config_file.lookupValue("cache_path", text)) {
+		_cache_path = text;
+	}
+	if (config_file.lookupValue("archive_format", text)) {
+		if (text == "manifest" || text == "bundle" || text == "tar") {
+			_archive_format = text;
+		} else {
+			fmt::print("Unknown archive format in {0:s}: {1:s}\n", path, text);
+		}
+	}
+	if (config_file.lookupValue("durability", text)) {
+		_durability = text;
+	}
+	if (config_file.lookupValue("verbosity", text)) {
+		_verbosity = text;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "hash.h"
+#include "system.h"
+
+/*
+ * A class that provides the application configuration.
+ *
+ * Settings are read from the init.cfg of every configuration path (global < local < project),
+ * later files override earlier ones. The merged result is cached per set of configuration
+ * paths and reused as long as none of the files changed.
+*/
+class SystemConfig
+{
+public:
+	SystemConfig(const vector<file_path> &paths);
+	SystemConfig();
+
+	unsigned threads();
+	size_t block_size();
+	file_path cache_path();
+	uintmax_t cache_size();
+	string archive_format();
+	string durability();
+	string verbosity();
+	unsigned prewarm();
+	uintmax_t large_file_size();
+	void load();
+
+private:
+	json signature();
+	json values();
+	void set_values(const json &values);
+	void read(const file_path &path);
+
+	vector<file_path> _paths = SystemPaths::config_paths();
+	unsigned _threads = 0;
+	size_t _block_size = 10240;
+	file_path _cache_path = (SystemRuntime::is_root() ? SystemBasePaths::global_data_path() :
+		SystemBasePaths::local_data_path()).string() + separator + "cache";
+	uintmax_t _cache_size = 0;
+	string _archive_format;
+	string _durability = "none";
+	string _verbosity = "normal";
+	unsigned _prewarm = 0;
+	uintmax_t _large_file_size = 16777216;
+};
@@ -0,0 +1,172 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "digest.h"
+
+TemplateDigests::TemplateDigests(const json &digests)
+{
+	if (!digests.is_object()) {
+		return;
+	}
+	if (!parse_algorithm(digests.value("algorithm", string("xxh3")), _algorithm)) {
+		fmt::print("Unknown digest algorithm: {0:s}\n", digests.value("algorithm", string()));
+		return;
+	}
+	if (!digests.contains("files") || !digests["files"].is_object()) {
+		return;
+	}
+	for (const auto &file : digests["files"].items()) {
+		if (file.value().is_string()) {
+			_files[TemplateFilter::normalize(file.key())] = file.value().get<string>();
+		}
+	}
+}
+
+TemplateDigests::TemplateDigests()
+{}
+
+/*
+ * Returns true if no file digests are listed.
+*/
+bool TemplateDigests::empty() const
+{
+	return _files.empty();
+}
+
+/*
+ * Returns true if extracted files need an XXH3 checksum for checking them.
+*/
+bool TemplateDigests::checksum() const
+{
+	return !_files.empty() && _algorithm == TemplateDigestAlgorithm::xxh3;
+}
+
+/*
+ * Returns true if extracted files need a SHA-256 digest for checking them.
+*/
+bool TemplateDigests::cryptographic() const
+{
+	return !_files.empty() && _algorithm == TemplateDigestAlgorithm::sha256;
+}
+
+/*
+ * Returns true if mismatching files fail the extraction.
+*/
+bool TemplateDigests::verify() const
+{
+	return _verify;
+}
+
+/*
+ * Returns the algorithm of the listed digests.
+*/
+TemplateDigestAlgorithm TemplateDigests::algorithm() const
+{
+	return _algorithm;
+}
+
+/*
+ * Enable or disable failing the extraction on mismatching files.
+*/
+void TemplateDigests::set_verify(bool verify)
+{
+	_verify = verify;
+}
+
+/*
+ * Check an extracted file against its listed digest.
+ *
+ * The hash must compute the digests requested by the checksum and cryptographic functions.
+*/
+bool TemplateDigests::check(const string &pathname, HashDigest &hash) const
+{
+	if (_files.empty()) {
+		return true;
+	}
+
+	return check(pathname, (_algorithm == TemplateDigestAlgorithm::xxh3) ? hash.xxh3() : hash.sha256());
+}
+
+/*
+ * Check a digest of an extracted file against its listed digest.
+ *
+ * Files that aren't listed always pass. Returns false only if the digest
+ * mismatches in verify mode, otherwise mismatches are printed as warnings.
+*/
+bool TemplateDigests::check(const string &pathname, const string &digest) const
+{
+	auto file = _files.find(TemplateFilter::normalize(pathname));
+
+	if (file == _files.end() || file->second == digest) {
+		return true;
+	}
+	if (_verify) {
+		fmt::print("Digest mismatch: {0:s} (expected {1:s}, got {2:s})\n", pathname, file->second, digest);
+		return false;
+	}
+
+	fmt::print("Warning: digest mismatch: {0:s} (expected {1:s}, got {2:s})\n", pathname, file->second, digest);
+	return true;
+}
+
+/*
+ * Returns true if a digest is listed for a file.
+*/
+bool TemplateDigests::listed(const string &pathname) const
+{
+	return _files.count(TemplateFilter::normalize(pathname)) > 0;
+}
+
+/*
+ * Check that every listed file was extracted, after extracting the template's layer.
+ *
+ * Files excluded by the filter's feature groups aren't expected. Returns false
+ * only if a file is missing in verify mode, otherwise missing files are printed as warnings.
+*/
+bool TemplateDigests::complete(TemplateFilter &filter) const
+{
+	bool missing = false;
+
+	for (const auto &[pathname, digest] : _files) {
+		if (filter.claimed(pathname) || !filter.includes(pathname)) {
+			continue;
+		}
+
+		fmt::print("{0:s} file listed in the digests: {1:s}\n", _verify ? "Missing" : "Warning: missing", pathname);
+		missing = true;
+	}
+
+	return !missing || !_verify;
+}
+
+/*
+ * Parse a digest algorithm name (xxh3, sha256).
+*/
+bool TemplateDigests::parse_algorithm(const string &name, TemplateDigestAlgorithm &algorithm)
+{
+	if (name == "xxh3") {
+		algorithm = TemplateDigestAlgorithm::xxh3;
+	} else if (name == "sha256") {
+		algorithm = TemplateDigestAlgorithm::sha256;
+	} else {
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,63 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include "global.h"
+#include "filter.h"
+#include "hash.h"
+
+/*
+ * The algorithm of the file digests listed by a template.
+*/
+enum class TemplateDigestAlgorithm
+{
+	xxh3,
+	sha256
+};
+
+/*
+ * Digests of the project files of a template, read from the "digests" object of info.json.
+ *
+ * Files are checked while they are extracted, using the hashes computed on the way.
+ * Mismatches are reported as warnings, in verify mode they fail the extraction instead.
+*/
+class TemplateDigests
+{
+public:
+	TemplateDigests(const json &digests);
+	TemplateDigests();
+
+	bool empty() const;
+	bool checksum() const;
+	bool cryptographic() const;
+	bool verify() const;
+	TemplateDigestAlgorithm algorithm() const;
+	void set_verify(bool verify);
+	bool check(const string &pathname, HashDigest &hash) const;
+	bool check(const string &pathname, const string &digest) const;
+	bool listed(const string &pathname) const;
+	bool complete(TemplateFilter &filter) const;
+
+	static bool parse_algorithm(const string &name, TemplateDigestAlgorithm &algorithm);
+
+private:
+	TemplateDigestAlgorithm _algorithm = TemplateDigestAlgorithm::xxh3;
+	unordered_map<string, string> _files;
+	bool _verify = false;
+};
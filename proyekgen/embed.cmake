@@ -0,0 +1,81 @@
+# Generates the index and data of the embedded templates for embedded.cpp
+#
+# Usage: cmake -DOUTPUT=<file> -DTEMPLATES=<path|path|...> -P embed.cmake
+#
+# The info.json, Lua runners and tar project data of every template are embedded,
+# files are sorted by their path so they can be looked up with a binary search.
+
+string(REPLACE "|" ";" template_paths "${TEMPLATES}")
+set(embedded_files)
+
+foreach(template_path ${template_paths})
+	get_filename_component(template_name "${template_path}" NAME)
+	file(GLOB_RECURSE template_files RELATIVE "${template_path}" "${template_path}/*.lua")
+	list(APPEND template_files "info.json")
+
+	foreach(project_file "project.tar.xz" "project.tar.zst")
+		if(EXISTS "${template_path}/${project_file}")
+			list(APPEND template_files ${project_file})
+		endif()
+	endforeach()
+	if(NOT EXISTS "${template_path}/info.json")
+		message(FATAL_ERROR "Cannot embed ${template_path}: missing info.json")
+	endif()
+	foreach(template_file ${template_files})
+		list(APPEND embedded_files "${template_name}/${template_file}")
+		set("embedded_source_${template_name}/${template_file}" "${template_path}/${template_file}")
+	endforeach()
+endforeach()
+
+list(SORT embedded_files)
+set(embedded_index "")
+set(embedded_count 0)
+# xxd converts the files if it's installed. Otherwise they're converted in chunks of 4 KiB
+# (one line each), so the regular expression never runs over a whole project archive
+find_program(embed_xxd xxd)
+set(chunk_size 4096)
+
+file(WRITE "${OUTPUT}.tmp" "// Generated by embed.cmake, do not edit\n\n")
+
+foreach(embedded_path ${embedded_files})
+	set(source_path "${embedded_source_${embedded_path}}")
+	file(SIZE "${source_path}" source_size)
+	file(APPEND "${OUTPUT}.tmp" "static constexpr unsigned char embedded_data_${embedded_count}[] = {\n")
+
+	if(source_size EQUAL 0)
+		file(APPEND "${OUTPUT}.tmp" "0\n")
+	endif()
+
+	set(offset 0)
+
+	if(embed_xxd AND source_size GREATER 0)
+		execute_process(COMMAND "${embed_xxd}" -i INPUT_FILE "${source_path}" OUTPUT_VARIABLE source_bytes
+			RESULT_VARIABLE xxd_result)
+
+		if(NOT xxd_result EQUAL 0)
+			message(FATAL_ERROR "Cannot embed ${source_path}: xxd failed")
+		endif()
+
+		file(APPEND "${OUTPUT}.tmp" "${source_bytes}")
+		set(offset ${source_size})
+	endif()
+	while(offset LESS source_size)
+		file(READ "${source_path}" chunk_hex OFFSET ${offset} LIMIT ${chunk_size} HEX)
+		string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," chunk_bytes "${chunk_hex}")
+		file(APPEND "${OUTPUT}.tmp" "${chunk_bytes}\n")
+		math(EXPR offset "${offset} + ${chunk_size}")
+	endwhile()
+
+	file(APPEND "${OUTPUT}.tmp" "};\n")
+	string(APPEND embedded_index "\t{\"${embedded_path}\", embedded_data_${embedded_count}, ${source_size}},\n")
+	math(EXPR embedded_count "${embedded_count} + 1")
+endforeach()
+
+file(APPEND "${OUTPUT}.tmp"
+	"\nstatic constexpr TemplateEmbeddedFile embedded_files[] = {\n${embedded_index}};\n"
+	"static constexpr size_t embedded_count = ${embedded_count};\n"
+)
+
+# Only touch the output if it changed, so embedded.cpp isn't rebuilt needlessly
+file(COPY_FILE "${OUTPUT}.tmp" "${OUTPUT}" ONLY_IF_DIFFERENT)
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,84 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "embedded.h"
+
+#if defined(PROYEKGEN_EMBEDDED)
+// Generated by embed.cmake, defines embedded_files sorted by path and embedded_count
+#include "embedded_data.inc"
+#else
+static constexpr TemplateEmbeddedFile embedded_files[] = {{"", nullptr, 0}};
+static constexpr size_t embedded_count = 0;
+#endif
+
+const file_path TemplateEmbedded::root_path = "<embedded>";
+
+/*
+ * Returns the identifiers of the embedded templates.
+*/
+vector<string> TemplateEmbedded::templates()
+{
+	vector<string> result;
+	const string info_name = "/info.json";
+
+	for (size_t i = 0; i < embedded_count; i++) {
+		string path = embedded_files[i].path;
+		size_t slash = path.find('/');
+
+		// Templates are the top-level directories with an info.json
+		if (slash != string::npos && path.compare(slash, string::npos, info_name) == 0) {
+			result.push_back(path.substr(0, slash));
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Find the data of an embedded file using its path under the embedded root.
+ *
+ * Returns false if the path isn't an embedded file.
+*/
+bool TemplateEmbedded::find(const file_path &path, const unsigned char *&data, size_t &size)
+{
+	if (!contains(path)) {
+		return false;
+	}
+
+	string pathname = path.lexically_relative(root_path).generic_string();
+	const TemplateEmbeddedFile *end = embedded_files + embedded_count;
+	const TemplateEmbeddedFile *file = std::lower_bound(embedded_files, end, pathname,
+		[](const TemplateEmbeddedFile &f, const string &p) { return strcmp(f.path, p.c_str()) < 0; });
+
+	if (file == end || pathname != file->path) {
+		return false;
+	}
+
+	data = file->data;
+	size = file->size;
+	return true;
+}
+
+/*
+ * Returns true if the path is under the embedded root.
+*/
+bool TemplateEmbedded::contains(const file_path &path)
+{
+	return embedded_count > 0 && !path.empty() && *path.begin() == root_path;
+}
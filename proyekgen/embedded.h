@@ -0,0 +1,49 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include "global.h"
+
+/*
+ * A file of a template embedded into the executable.
+ *
+ * The path is relative to the embedded root, starting with the template's identifier.
+*/
+struct TemplateEmbeddedFile
+{
+	const char *path;
+	const unsigned char *data;
+	size_t size;
+};
+
+/*
+ * Templates embedded into the executable at build time (PROYEKGEN_EMBED_TEMPLATES).
+ *
+ * Embedded templates live under a virtual root path, their info.json, runners and project
+ * data are served from memory instead of the filesystem. Only tar project data is embedded.
+*/
+class TemplateEmbedded
+{
+public:
+	static vector<string> templates();
+	static bool find(const file_path &path, const unsigned char *&data, size_t &size);
+	static bool contains(const file_path &path);
+
+	static const file_path root_path;
+};
@@ -0,0 +1,245 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "filter.h"
+
+/*
+ * Parses the "features" object of a template's info.json.
+ *
+ * A feature group is either a list of glob patterns (enabled by default),
+ * or an object with "files" and "default" keys.
+*/
+TemplateFilter::TemplateFilter(const json &features)
+{
+	if (!features.is_object()) {
+		return;
+	}
+	for (const auto &[name, value] : features.items()) {
+		TemplateFeature feature;
+		feature.name = name;
+
+		if (value.is_array()) {
+			feature.patterns = value.get<vector<string>>();
+		} else if (value.is_object()) {
+			feature.patterns = value.value("files", vector<string>());
+			feature.enabled = value.value("default", true);
+		}
+
+		_features.push_back(feature);
+	}
+}
+
+TemplateFilter::TemplateFilter()
+{}
+
+/*
+ * Returns the feature groups.
+*/
+vector<TemplateFeature> TemplateFilter::features()
+{
+	return _features;
+}
+
+/*
+ * Enable or disable a feature group.
+ *
+ * Returns false if the template has no feature group with that name.
+*/
+bool TemplateFilter::enable(const string &name, bool enabled)
+{
+	for (TemplateFeature &feature : _features) {
+		if (feature.name == name) {
+			feature.enabled = enabled;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Returns true if a file is extracted.
+*/
+bool TemplateFilter::includes(const string &pathname)
+{
+	bool grouped = false;
+	string normalized = normalize(pathname);
+
+	for (const TemplateFeature &feature : _features) {
+		for (const string &pattern : feature.patterns) {
+			if (!match(pattern, normalized)) {
+				continue;
+			}
+			if (feature.enabled) {
+				return true;
+			}
+
+			grouped = true;
+		}
+	}
+
+	return !grouped;
+}
+
+/*
+ * Returns true if a file is extracted by the current layer, and marks it as claimed.
+ *
+ * Files claimed by the layers above the current one are never extracted again.
+*/
+bool TemplateFilter::claim(const string &pathname)
+{
+	string normalized = normalize(pathname);
+
+	if (_shadowed.count(normalized) || !includes(normalized)) {
+		return false;
+	}
+
+	_claimed.insert(normalized);
+	return true;
+}
+
+/*
+ * Returns true if a file was claimed by the current layer.
+*/
+bool TemplateFilter::claimed(const string &pathname) const
+{
+	return _claimed.count(normalize(pathname)) > 0;
+}
+
+/*
+ * Shadow the files claimed so far from the layers extracted next.
+*/
+void TemplateFilter::shadow()
+{
+	_shadowed.insert(_claimed.begin(), _claimed.end());
+	_claimed.clear();
+}
+
+/*
+ * Add the feature groups of a base template that aren't declared yet.
+*/
+void TemplateFilter::merge(const TemplateFilter &base)
+{
+	for (const TemplateFeature &feature : base._features) {
+		bool declared = std::any_of(_features.begin(), _features.end(),
+			[&](const TemplateFeature &f) { return f.name == feature.name; });
+
+		if (!declared) {
+			_features.push_back(feature);
+		}
+	}
+}
+
+/*
+ * Returns true if every file is extracted regardless of the feature groups.
+*/
+bool TemplateFilter::empty()
+{
+	for (const TemplateFeature &feature : _features) {
+		if (!feature.enabled) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Match a path against a glob pattern.
+ *
+ * "*" and "?" don't match "/", "**" matches across directories. Patterns without
+ * a "/" are matched against the file name at any depth, patterns ending with
+ * a directory followed by "**" also match the directory itself.
+*/
+bool TemplateFilter::match(const string &pattern, const string &pathname)
+{
+	if (pattern.find('/') == string::npos) {
+		size_t slash = pathname.rfind('/');
+		string filename = (slash == string::npos) ? pathname : pathname.substr(slash + 1);
+		return match_glob(pattern.c_str(), filename.c_str());
+	}
+	if (pattern.size() > 3 && pattern.compare(pattern.size() - 3, 3, "/**") == 0 &&
+		pattern.compare(0, pattern.size() - 3, pathname) == 0) {
+		return true;
+	}
+
+	return match_glob(pattern.c_str(), pathname.c_str());
+}
+
+/*
+ * Returns the pathname in the form used to compare template files.
+ *
+ * Tar entries may be prefixed with "./" and directories suffixed with "/".
+*/
+string TemplateFilter::normalize(const string &pathname)
+{
+	string normalized = pathname;
+
+	while (normalized.rfind("./", 0) == 0) {
+		normalized.erase(0, 2);
+	}
+	while (normalized.size() > 1 && normalized.back() == '/') {
+		normalized.pop_back();
+	}
+
+	return normalized;
+}
+
+/*
+ * Internally used by the match function
+*/
+bool TemplateFilter::match_glob(const char *pattern, const char *pathname)
+{
+	for (; *pattern != '\0'; pattern++, pathname++) {
+		if (pattern[0] == '*' && pattern[1] == '*' && pattern[2] == '\0') {
+			// A trailing "**" matches everything below
+			return true;
+		}
+		if (pattern[0] == '*' && pattern[1] == '*') {
+			// "**/" matches any number of whole directories (including none), so the rest
+			// of the pattern is only tried at the start of the path and after each '/'
+			bool directories = pattern[2] == '/';
+			const char *rest = directories ? pattern + 3 : pattern + 2;
+
+			for (const char *p = pathname;; p++) {
+				if ((!directories || p == pathname || p[-1] == '/') && match_glob(rest, p)) {
+					return true;
+				}
+				if (*p == '\0') {
+					return false;
+				}
+			}
+		}
+		if (pattern[0] == '*') {
+			for (const char *p = pathname;; p++) {
+				if (match_glob(pattern + 1, p)) {
+					return true;
+				}
+				if (*p == '\0' || *p == '/') {
+					return false;
+				}
+			}
+		}
+		if (*pathname == '\0' || (pattern[0] == '?' && *pathname == '/') ||
+			(pattern[0] != '?' && pattern[0] != *pathname)) {
+			return false;
+		}
+	}
+
+	return *pathname == '\0';
+}
@@ -0,0 +1,63 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+
+/*
+ * An optional group of template files, e.g. tests or docs.
+*/
+struct TemplateFeature
+{
+	string name;
+	vector<string> patterns;
+	bool enabled = true;
+};
+
+/*
+ * A class that decides which template files are extracted.
+ *
+ * Files that don't belong to any feature group are always included, files of
+ * feature groups are only included if one of their groups is enabled.
+ * When extracting layered templates, files claimed by a layer are shadowed in the layers below.
+*/
+class TemplateFilter
+{
+public:
+	TemplateFilter(const json &features);
+	TemplateFilter();
+
+	vector<TemplateFeature> features();
+	bool enable(const string &name, bool enabled = true);
+	bool includes(const string &pathname);
+	bool claim(const string &pathname);
+	bool claimed(const string &pathname) const;
+	void shadow();
+	void merge(const TemplateFilter &base);
+	bool empty();
+
+	static bool match(const string &pattern, const string &pathname);
+	static string normalize(const string &pathname);
+
+private:
+	static bool match_glob(const char *pattern, const char *pathname);
+
+	vector<TemplateFeature> _features;
+	unordered_set<string> _claimed;
+	unordered_set<string> _shadowed;
+};
@@ -20,6 +20,10 @@
 #pragma warning(disable: 4244)
 #pragma warning(disable: 4275)
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fstream>
@@ -27,8 +31,12 @@
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -36,12 +44,22 @@
 #include <Windows.h>
 #include <ShlObj.h>
 #include <direct.h>
+#include <io.h>
 #define chdir _chdir
-#elif defined(__linux__)
-#include "limits.h"
-#include "unistd.h"
 #elif defined(__APPLE__) && defined(__MACH__)
 #error Building on macOS is not supported.
+#else
+#include "fcntl.h"
+#include "limits.h"
+#include "unistd.h"
+#include "sys/file.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#endif
+
+#if defined(__linux__)
+#include "linux/fs.h"
+#include "sys/ioctl.h"
 #endif
 
 #include "archive.h"
@@ -54,13 +72,17 @@
 #include "libconfig.h++"
 #include "lua.hpp"
 #include "nlohmann/json.hpp"
+#include "xxhash.h"
 
 #define separator (char)std::filesystem::path::preferred_separator
 
 namespace filesystem = std::filesystem;
 
+template<class T>
+using atomic = std::atomic<T>;
 using config = libconfig::Config;
 using dir_entry = std::filesystem::directory_entry;
+using error_code = std::error_code;
 using exception = std::exception;
 using exception_ptr = std::exception_ptr;
 using file_path = std::filesystem::path;
@@ -69,13 +91,21 @@ using file_output = std::ofstream;
 template<class R, class... Args>
 using function = std::function<R(Args...)>;
 using json = nlohmann::json;
+using lock_guard = std::lock_guard<std::mutex>;
 template<class Key, class T>
 using map = std::map<Key, std::less<Key>, std::allocator<std::pair<const Key, T>>>;
+using mutex = std::mutex;
+using ordered_json = nlohmann::ordered_json;
 template<class Key, class T>
 using pair = std::pair<Key, T>;
 using steady_clock = std::chrono::steady_clock;
 using string = std::string;
 using stringstream = std::stringstream;
+using thread = std::thread;
+template<class Key, class T>
+using unordered_map = std::unordered_map<Key, T>;
+template<class T>
+using unordered_set = std::unordered_set<T>;
 template<class T>
 using vector = std::vector<T, std::allocator<T>>;
 using wstring = std::wstring;
@@ -0,0 +1,292 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "hash.h"
+#include "system.h"
+
+static const uint32_t sha256_constants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t sha256_rotate(uint32_t value, int bits)
+{
+	return (value >> bits) | (value << (32 - bits));
+}
+
+HashSha256::HashSha256()
+	: _state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+{}
+
+/*
+ * Feed data into the hasher.
+*/
+void HashSha256::update(const void *data, size_t size)
+{
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+
+	if (size == 0) {
+		return;
+	}
+
+	_length += size;
+
+	if (_buffered > 0) {
+		size_t count = std::min(size, sizeof(_buffer) - _buffered);
+		memcpy(_buffer + _buffered, bytes, count);
+		_buffered += count;
+		bytes += count;
+		size -= count;
+
+		if (_buffered < sizeof(_buffer)) {
+			return;
+		}
+
+		transform(_buffer);
+		_buffered = 0;
+	}
+	for (; size >= sizeof(_buffer); bytes += sizeof(_buffer), size -= sizeof(_buffer)) {
+		transform(bytes);
+	}
+
+	memcpy(_buffer, bytes, size);
+	_buffered = size;
+}
+
+/*
+ * Feed a string into the hasher.
+*/
+void HashSha256::update(const string &data)
+{
+	update(data.data(), data.size());
+}
+
+/*
+ * Finalize the hasher and return the digest in hexadecimal.
+ *
+ * The hasher must not be updated after calling this function.
+*/
+string HashSha256::finish()
+{
+	uint64_t bits = _length * 8;
+	unsigned char padding[72] = {0x80};
+	size_t padding_size = (_buffered < 56) ? 56 - _buffered : 120 - _buffered;
+
+	for (int i = 0; i < 8; i++) {
+		padding[padding_size + i] = static_cast<unsigned char>(bits >> (56 - i * 8));
+	}
+
+	update(padding, padding_size + 8);
+	string result;
+
+	for (uint32_t word : _state) {
+		result += fmt::format("{0:08x}", word);
+	}
+
+	return result;
+}
+
+/*
+ * Returns the digest of a file's contents.
+ *
+ * An empty string is returned if the file cannot be read.
+*/
+string HashSha256::file(const file_path &path)
+{
+	file_input stream(path, std::ios::binary);
+	HashSha256 hash;
+	char buffer[65536];
+
+	if (!stream.is_open()) {
+		return string();
+	}
+	while (stream.read(buffer, sizeof(buffer)) || stream.gcount() > 0) {
+		hash.update(buffer, static_cast<size_t>(stream.gcount()));
+	}
+
+	return hash.finish();
+}
+
+/*
+ * Returns the digest of a string.
+*/
+string HashSha256::text(const string &data)
+{
+	HashSha256 hash;
+	hash.update(data);
+	return hash.finish();
+}
+
+/*
+ * Internally used by the update function
+*/
+void HashSha256::transform(const unsigned char *block)
+{
+	uint32_t words[64];
+	uint32_t s[8];
+
+	for (int i = 0; i < 16; i++) {
+		words[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+			(uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = sha256_rotate(words[i - 15], 7) ^ sha256_rotate(words[i - 15], 18) ^ (words[i - 15] >> 3);
+		uint32_t s1 = sha256_rotate(words[i - 2], 17) ^ sha256_rotate(words[i - 2], 19) ^ (words[i - 2] >> 10);
+		words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+	}
+
+	memcpy(s, _state, sizeof(s));
+
+	for (int i = 0; i < 64; i++) {
+		uint32_t s1 = sha256_rotate(s[4], 6) ^ sha256_rotate(s[4], 11) ^ sha256_rotate(s[4], 25);
+		uint32_t choice = (s[4] & s[5]) ^ (~s[4] & s[6]);
+		uint32_t first = s[7] + s1 + choice + sha256_constants[i] + words[i];
+		uint32_t s0 = sha256_rotate(s[0], 2) ^ sha256_rotate(s[0], 13) ^ sha256_rotate(s[0], 22);
+		uint32_t majority = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+		uint32_t second = s0 + majority;
+
+		s[7] = s[6];
+		s[6] = s[5];
+		s[5] = s[4];
+		s[4] = s[3] + first;
+		s[3] = s[2];
+		s[2] = s[1];
+		s[1] = s[0];
+		s[0] = first + second;
+	}
+	for (int i = 0; i < 8; i++) {
+		_state[i] += s[i];
+	}
+}
+
+HashXxh3::HashXxh3()
+{}
+
+HashXxh3::~HashXxh3()
+{
+	if (_state != nullptr) {
+		XXH3_freeState(_state);
+	}
+}
+
+/*
+ * Feed data into the hasher.
+*/
+void HashXxh3::update(const void *data, size_t size)
+{
+	XXH3_64bits_update(state(), data, size);
+}
+
+/*
+ * Returns the digest in hexadecimal.
+*/
+string HashXxh3::finish()
+{
+	return fmt::format("{0:016x}", static_cast<uint64_t>(XXH3_64bits_digest(state())));
+}
+
+/*
+ * Returns the digest of a file's contents.
+ *
+ * An empty string is returned if the file cannot be read.
+*/
+string HashXxh3::file(const file_path &path)
+{
+	file_input stream(path, std::ios::binary);
+	HashXxh3 hash;
+	char buffer[65536];
+
+	if (!stream.is_open()) {
+		return string();
+	}
+	while (stream.read(buffer, sizeof(buffer)) || stream.gcount() > 0) {
+		hash.update(buffer, static_cast<size_t>(stream.gcount()));
+	}
+
+	return hash.finish();
+}
+
+/*
+ * Internally used by the update and finish functions
+ *
+ * Allocates the hash state when it's first used.
+*/
+XXH3_state_t *HashXxh3::state()
+{
+	if (_state != nullptr) {
+		return _state;
+	}
+
+	_state = XXH3_createState();
+
+	if (_state == nullptr) {
+		fmt::print("Cannot allocate the XXH3 hash state\n");
+		SystemRuntime::fatal();
+	}
+
+	XXH3_64bits_reset(_state);
+	return _state;
+}
+
+HashDigest::HashDigest(bool xxh3, bool sha256)
+	: _checksum(xxh3), _cryptographic(sha256)
+{}
+
+/*
+ * Feed data into the requested hashers.
+*/
+void HashDigest::update(const void *data, size_t size)
+{
+	if (_checksum) {
+		_xxh3.update(data, size);
+	}
+	if (_cryptographic) {
+		_sha256.update(data, size);
+	}
+}
+
+/*
+ * Returns the SHA-256 digest of the data, or an empty string if it wasn't requested.
+*/
+const string &HashDigest::sha256()
+{
+	if (_cryptographic && _sha256_digest.empty()) {
+		_sha256_digest = _sha256.finish();
+	}
+
+	return _sha256_digest;
+}
+
+/*
+ * Returns the XXH3 digest of the data, or an empty string if it wasn't requested.
+*/
+const string &HashDigest::xxh3()
+{
+	if (_checksum && _xxh3_digest.empty()) {
+		_xxh3_digest = _xxh3.finish();
+	}
+
+	return _xxh3_digest;
+}
@@ -0,0 +1,95 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+
+/*
+ * An incremental SHA-256 hasher.
+ *
+ * Data can be fed in any number of update calls, the digest
+ * is returned as a lowercase hexadecimal string by finish.
+*/
+class HashSha256
+{
+public:
+	HashSha256();
+
+	void update(const void *data, size_t size);
+	void update(const string &data);
+	string finish();
+
+	static string file(const file_path &path);
+	static string text(const string &data);
+
+private:
+	void transform(const unsigned char *block);
+
+	uint32_t _state[8];
+	unsigned char _buffer[64];
+	uint64_t _length = 0;
+	size_t _buffered = 0;
+};
+
+/*
+ * An incremental XXH3 (64-bit) hasher.
+ *
+ * XXH3 is not cryptographic, it is only used as a fast checksum of template files.
+ * The hash state is only allocated once data is fed (or the digest is read).
+*/
+class HashXxh3
+{
+public:
+	HashXxh3();
+	HashXxh3(const HashXxh3&) = delete;
+	HashXxh3 &operator=(const HashXxh3&) = delete;
+	~HashXxh3();
+
+	void update(const void *data, size_t size);
+	string finish();
+
+	static string file(const file_path &path);
+
+private:
+	XXH3_state_t *state();
+
+	XXH3_state_t *_state = nullptr;
+};
+
+/*
+ * Hashes the same data with XXH3, SHA-256, both or neither.
+ *
+ * Only the requested digests are computed, they can be read any number of times once all data was fed.
+*/
+class HashDigest
+{
+public:
+	HashDigest(bool xxh3, bool sha256);
+
+	void update(const void *data, size_t size);
+	const string &sha256();
+	const string &xxh3();
+
+private:
+	HashSha256 _sha256;
+	HashXxh3 _xxh3;
+	bool _checksum;
+	bool _cryptographic;
+	string _sha256_digest;
+	string _xxh3_digest;
+};
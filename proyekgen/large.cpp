@@ -0,0 +1,162 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include "large.h"
+
+ProjectLargeFile::ProjectLargeFile(const string &path, TemplateMetadataPolicy metadata)
+	: _path(path), _metadata(metadata)
+{}
+
+ProjectLargeFile::~ProjectLargeFile()
+{
+#if defined(__linux__)
+	if (_fd >= 0) {
+		::close(_fd);
+	}
+#endif
+}
+
+/*
+ * Create the file with its final size.
+ *
+ * The minimal metadata policy creates the file with its mode under the umask instead of restoring it.
+*/
+bool ProjectLargeFile::open(uint64_t size, uint32_t mode, bool sparse)
+{
+	error_code error;
+	_size = size;
+	filesystem::create_directories(file_path(_path).parent_path(), error);
+	filesystem::remove(_path, error);
+#if defined(__linux__)
+	_fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		(_metadata == TemplateMetadataPolicy::minimal) ? (mode & 0777) : 0600);
+
+	if (_fd < 0) {
+		fmt::print("Cannot write file {0:s}: {1:s}\n", _path, strerror(errno));
+		return false;
+	}
+	if (!sparse && size > 0 && fallocate(_fd, 0, 0, static_cast<off_t>(size)) != 0 &&
+		errno != EOPNOTSUPP && errno != ENOSYS) {
+		// Unsupported filesystems just don't preallocate, unlike posix_fallocate this never writes zeros
+		fmt::print("Cannot allocate file {0:s}: {1:s}\n", _path, strerror(errno));
+		return false;
+	}
+	if (ftruncate(_fd, static_cast<off_t>(size)) != 0) {
+		fmt::print("Cannot resize file {0:s}: {1:s}\n", _path, strerror(errno));
+		return false;
+	}
+#else
+	_stream.open(_path, std::ios::binary | std::ios::trunc);
+
+	if (!_stream.is_open()) {
+		fmt::print("Cannot write file: {0:s}\n", _path);
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+/*
+ * Write a block of data at an offset of the file.
+ *
+ * Runs of zero blocks are skipped, the file already reads as zeros there.
+*/
+bool ProjectLargeFile::write(const void *buffer, size_t size, uint64_t offset)
+{
+	static const char zeros[4096] = {};
+	const char *data = static_cast<const char*>(buffer);
+
+	for (size_t i = 0; i < size;) {
+		size_t end = i;
+
+		// Find the next run of blocks that aren't all zeros
+		while (end < size && (size - end < sizeof(zeros) || memcmp(data + end, zeros, sizeof(zeros)) != 0)) {
+			end += std::min(sizeof(zeros), size - end);
+		}
+#if defined(__linux__)
+		while (i < end) {
+			ssize_t written = pwrite(_fd, data + i, end - i, static_cast<off_t>(offset + i));
+
+			if (written < 0) {
+				fmt::print("Cannot write file {0:s}: {1:s}\n", _path, strerror(errno));
+				return false;
+			}
+
+			i += static_cast<size_t>(written);
+		}
+#else
+		if (i < end) {
+			_stream.seekp(static_cast<std::streamoff>(offset + i));
+			_stream.write(data + i, static_cast<std::streamsize>(end - i));
+		}
+		if (!_stream) {
+			fmt::print("Cannot write file: {0:s}\n", _path);
+			return false;
+		}
+#endif
+
+		i = std::min(end + sizeof(zeros), size);
+	}
+
+	return true;
+}
+
+/*
+ * Close the file and restore its metadata according to the metadata policy.
+*/
+bool ProjectLargeFile::close(uint32_t mode, int64_t mtime)
+{
+#if defined(__linux__)
+	if (_metadata != TemplateMetadataPolicy::minimal) {
+		struct timespec times[2] = {};
+		times[0].tv_sec = times[1].tv_sec = static_cast<time_t>(mtime);
+		fchmod(_fd, mode & 07777);
+		futimens(_fd, times);
+	}
+
+	int result = ::close(_fd);
+	_fd = -1;
+
+	if (result != 0) {
+		fmt::print("Cannot write file {0:s}: {1:s}\n", _path, strerror(errno));
+		return false;
+	}
+#else
+	error_code error;
+	_stream.close();
+
+	if (!_stream) {
+		fmt::print("Cannot write file: {0:s}\n", _path);
+		return false;
+	}
+
+	// Trailing zeros were never written
+	filesystem::resize_file(_path, _size, error);
+
+	if (error) {
+		fmt::print("Cannot resize file {0:s}: {1:s}\n", _path, error.message());
+		return false;
+	}
+
+	TemplateMetadata::apply(_path, mode, static_cast<time_t>(mtime), _metadata);
+#endif
+
+	return true;
+}
@@ -0,0 +1,52 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include "global.h"
+#include "metadata.h"
+
+/*
+ * A large project file written block by block at arbitrary offsets.
+ *
+ * The file is preallocated up front (or only truncated to its size if it's sparse),
+ * zero-filled blocks are seeked over instead of being written. Only the block being
+ * written is kept in memory regardless of the file size.
+*/
+class ProjectLargeFile
+{
+public:
+	ProjectLargeFile(const string &path, TemplateMetadataPolicy metadata);
+	~ProjectLargeFile();
+	ProjectLargeFile(const ProjectLargeFile &) = delete;
+	ProjectLargeFile &operator=(const ProjectLargeFile &) = delete;
+
+	bool open(uint64_t size, uint32_t mode, bool sparse);
+	bool write(const void *buffer, size_t size, uint64_t offset);
+	bool close(uint32_t mode, int64_t mtime);
+
+private:
+	string _path;
+	TemplateMetadataPolicy _metadata;
+	uint64_t _size = 0;
+#if defined(__linux__)
+	int _fd = -1;
+#else
+	file_output _stream;
+#endif
+};
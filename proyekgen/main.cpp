@@ -16,27 +16,22 @@
 	along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include "cache.h"
+#include "config.h"
 #include "input.h"
+#include "pack.h"
+#include "search.h"
+#include "stage.h"
+#include "sync.h"
 #include "system.h"
 #include "template.h"
+#include "usage.h"
 
 int main(int argc, char *argv[])
 {
-	// Read application configuration from a list of paths
-	for (const file_path &config_path : SystemPaths::config_paths()) {
-		const string &config_filepath = config_path.string() + separator + "init.cfg";
-		config config_file;
-
-		if (!filesystem::is_regular_file(config_filepath)) {
-			continue;
-		}
-		try {
-			config_file.readFile(config_filepath.c_str());
-		} catch (libconfig::ParseException ex) {
-			fmt::print("Cannot read configuration file {0:s} at {1:s}\n", ex.getFile(), ex.getLine());
-			continue;
-		}
-	}
+	// Read application configuration from a list of paths, command-line options override it
+	SystemConfig app_config;
+	app_config.load();
 
 	// Parse command-line arguments
 	cmd_options options_parser = cmd_options(PROYEKGEN_HELP_NAME, string());
@@ -47,23 +42,63 @@ int main(int argc, char *argv[])
 		("s,search-paths", "Append additional search paths",
 			cxxopts::value<vector<string>>()->default_value({}), "paths")
 		("l,list", "List installed templates")
+		("search", "Search installed templates by identifier, name, author, tags and description",
+			cxxopts::value<string>()->default_value(string()), "query")
+		("search-limit", "Maximum number of search results (0 shows every match)",
+			cxxopts::value<size_t>()->default_value("20"), "count")
 		("info", "Print template information")
-		("user", fmt::format("Filter user-specific templates, only applicable to {0:s}", "-l/--list"))
+		("contents", "List the files of the template's project data")
+		("plan", "Print the files and runners of a generation without writing anything")
+		("pull", "Only extract a single file of the template's project data",
+			cxxopts::value<string>()->default_value(string()), "file")
+		("user", fmt::format("Filter user-specific templates, only applicable to {0:s}", "-l/--list and --search"))
 		("skip-generator", "Do not generate the project")
-		("skip-runners", "Do not execute runners");
+		("skip-runners", "Do not execute runners")
+		("with", "Enable optional feature groups of the template",
+			cxxopts::value<vector<string>>()->default_value({}), "features")
+		("without", "Disable feature groups of the template",
+			cxxopts::value<vector<string>>()->default_value({}), "features")
+		("update", "Only write new or changed files into an existing project, keeping local changes")
+		("verify", "Fail the generation if a project file doesn't match the template's digests")
+		("no-runner-cache", "Always execute runners instead of restoring cached outputs")
+		("import", "Import a template directory into the deduplicating template store",
+			cxxopts::value<string>()->default_value(string()), "path")
+		("store-link", "How files are materialized from the template store (copy, reflink, hardlink)",
+			cxxopts::value<string>()->default_value("reflink"), "mode")
+		("convert", "Convert the project.tar.xz of a template directory into an indexed bundle",
+			cxxopts::value<string>()->default_value(string()), "path")
+		("pack-format", "Compression of the project data created by the pack command (xz, zstd)",
+			cxxopts::value<string>()->default_value("xz"), "format")
+		("pack-mirror", "Compress every packed file on its own, so mirror updates only read changed files (zstd)")
+		("arguments", "Arguments of a command", cxxopts::value<vector<string>>()->default_value({}));
 	options_parser.add_options("Output")
 		("o,output", "Specify output directory",
-			cxxopts::value<string>()->default_value(SystemPaths::current_path().string()), "path");
+			cxxopts::value<string>()->default_value(SystemPaths::current_path().string()), "path")
+		("output-format", "Write the project into a directory, or stream it into an archive (directory, tar, tar.zst, -)",
+			cxxopts::value<string>()->default_value("directory"), "format")
+		("durability", "How the generated project is flushed to disk (none, syncfs, fsync)",
+			cxxopts::value<string>()->default_value(app_config.durability()), "policy")
+		("metadata", "How much file metadata is restored (full, standard, minimal), overrides the template's policy",
+			cxxopts::value<string>()->default_value(string()), "policy")
+		("buffer-size", "Size of the blocks read from the project data in bytes",
+			cxxopts::value<size_t>()->default_value(to_string(app_config.block_size())), "bytes")
+		("large-file-size", "Preallocate and write files of at least this size sparsely",
+			cxxopts::value<uintmax_t>()->default_value(to_string(app_config.large_file_size())), "bytes");
 	options_parser.add_options("Misc")
+		("j,jobs", "Number of worker threads (0 uses every available core)",
+			cxxopts::value<unsigned>()->default_value(to_string(app_config.threads())), "threads")
+		("verbosity", "How much progress is printed (quiet, normal, verbose)",
+			cxxopts::value<string>()->default_value(app_config.verbosity()), "level")
 		("h,help", "View help information")
 		("v,version", "Print program version");
 
-	options_parser.parse_positional({"template"});
+	options_parser.parse_positional({"template", "arguments"});
 	auto options = options_parser.parse(argc, argv);
 
 	// Show help info or print program version if passed from command-line options
 	if (options.count("help")) {
-		const string help = options_parser.custom_help("<TEMPLATE> [OPTIONS...]")
+		const string help = options_parser.custom_help(
+			"<TEMPLATE> [OPTIONS...] | pack <DIRECTORY> [OPTIONS...] | install|update <SOURCE> | prewarm [COUNT]")
 			.positional_help(string()).help();
 
 		fmt::print("{0:s}\n", help);
@@ -74,46 +109,164 @@ int main(int argc, char *argv[])
 		return EXIT_SUCCESS;
 	}
 
+	if (!SystemRuntime::set_verbosity(options["verbosity"].as<string>())) {
+		fmt::print("Unknown verbosity: {0:s}\n", options["verbosity"].as<string>());
+		SystemRuntime::fatal();
+	}
+
+	// Run a command instead of generating a project if passed from command-line arguments
+	const vector<string> &command_arguments = options["arguments"].as<vector<string>>();
+
+	if (options["template"].as<string>() == "pack" && command_arguments.size() == 1) {
+		// Pack a directory into the project data of a template, written to the output directory
+		TemplatePacker packer = TemplatePacker(command_arguments[0]);
+		packer.set_format(options["pack-format"].as<string>());
+		packer.set_threads(options["jobs"].as<unsigned>());
+		packer.set_mirror(options.count("pack-mirror") > 0);
+		return packer.pack(options["output"].as<string>()) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if ((options["template"].as<string>() == "install" || options["template"].as<string>() == "update") &&
+		command_arguments.size() == 1) {
+		// Install (or update) a template from a mirror, only reading the chunks that changed
+		TemplateSync sync = TemplateSync(command_arguments[0]);
+		file_path templates_path = SystemRuntime::is_root() ? SystemBasePaths::global_templates_path() :
+			SystemBasePaths::local_templates_path();
+		bool installed = sync.install(templates_path.string() + separator + sync.source().filename().string(),
+			options["template"].as<string>() == "update");
+		return installed ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (options["template"].as<string>() == "prewarm" && command_arguments.size() <= 1) {
+		// Read the files of the most used templates ahead into the page cache
+		size_t count = (app_config.prewarm() > 0) ? app_config.prewarm() : 5;
+
+		if (!command_arguments.empty()) {
+			const char *argument = command_arguments[0].c_str();
+			char *end = nullptr;
+
+			errno = 0;
+			count = std::strtoul(argument, &end, 10);
+
+			if (!std::isdigit(static_cast<unsigned char>(argument[0])) || *end != '\0' || errno == ERANGE) {
+				fmt::print("Invalid number of templates: {0:s}\n", argument);
+				SystemRuntime::fatal();
+			}
+		}
+
+		vector<TemplateUsageEntry> templates = TemplateUsage().most_used(count);
+
+		for (const TemplateUsageEntry &entry : templates) {
+			size_t files = TemplateUsage::prewarm(entry.path);
+			fmt::print("Prewarmed {0:s} ({1:d} files, used {2:d} times)\n", entry.path, files, entry.count);
+		}
+		if (templates.empty()) {
+			fmt::print("No template usage recorded yet.\n");
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	// Read the most used templates ahead in the background while the template library loads,
+	// only when a project is generated
+	if (app_config.prewarm() > 0 && !options["template"].as<string>().empty() && !options.count("list") &&
+		options["search"].as<string>().empty() && options["import"].as<string>().empty() &&
+		options["convert"].as<string>().empty()) {
+		vector<file_path> prewarm_paths;
+
+		for (const TemplateUsageEntry &entry : TemplateUsage().most_used(app_config.prewarm())) {
+			prewarm_paths.push_back(entry.path);
+		}
+
+		TemplateUsage::prewarm_background(prewarm_paths);
+	}
+
 	// Find the given template from the command-line options
 	vector<string> template_search_paths = options["search-paths"].as<vector<string>>();
 	string template_name = options["template"].as<string>();
 	file_path output_path = options["output"].as<string>();
-	TemplateLibrary library = TemplateLibrary(template_search_paths);
+	bool listing = options.count("list") || !options["search"].as<string>().empty();
+	TemplateLibrary library = TemplateLibrary(template_search_paths, app_config.archive_format(),
+		options["jobs"].as<unsigned>(), listing ? string() : template_name);
+
+	// Import a template into the template store if passed from command-line options
+	if (!options["import"].as<string>().empty()) {
+		file_path import_path = filesystem::absolute(options["import"].as<string>()).lexically_normal();
+		file_path templates_path = SystemRuntime::is_root() ? SystemBasePaths::global_templates_path() :
+			SystemBasePaths::local_templates_path();
+
+		if (import_path.filename().empty()) {
+			import_path = import_path.parent_path();
+		}
+
+		TemplateStore store;
+		bool imported = store.import(import_path, templates_path.string() + separator +
+			import_path.filename().string());
+		return imported ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Convert a template's project data into an indexed bundle if passed from command-line options
+	if (!options["convert"].as<string>().empty()) {
+		file_path convert_path = options["convert"].as<string>();
+		bool converted = TemplateBundle::convert(convert_path.string() + separator + "project.tar.xz",
+			convert_path.string() + separator + TemplateBundle::bundle_name);
+		return converted ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 
 	// Make absolute path for output directory if relative
 	if (output_path.is_relative()) {
 		output_path = SystemPaths::current_path().string() + separator + output_path.string();
 	}
-	// List installed templates if passed from command-line options
-	if (options.count("list")) {
-		vector<Template> templates = library.list();
+	// List (or search) installed templates if passed from command-line options
+	if (listing) {
+		const string &search_query = options["search"].as<string>();
+		vector<const Template*> templates;
+
+		if (!search_query.empty()) {
+			TemplateSearch search = TemplateSearch(library.list());
 
+			for (size_t position : search.search(search_query)) {
+				templates.push_back(&library.list()[position]);
+			}
+		} else {
+			for (const Template &t : library.list()) {
+				templates.push_back(&t);
+			}
+		}
 		if (options.count("user")) {
 			// Remove any listed templates that were installed globally.
 			string path_prefix = SystemPaths::template_paths()[1].string();
 			string current_path_prefix = SystemPaths::template_paths()[2].string();
 
-			for (int i = 0; i < templates.size(); i++) {
-				if (templates[i].path().string().rfind(path_prefix, 0) != 0 &&
-					templates[i].path().string().rfind(current_path_prefix, 0) != 0) {
-					// The template's path prefix is not located on local or current paths, remove.
-					templates.erase(templates.begin() + i);
-				}
-			}
+			templates.erase(std::remove_if(templates.begin(), templates.end(), [&](const Template *t) {
+				// The template's path prefix is not located on local or current paths, remove.
+				return t->path().string().rfind(path_prefix, 0) != 0 &&
+					t->path().string().rfind(current_path_prefix, 0) != 0;
+			}), templates.end());
+		}
+		if (!search_query.empty() && options["search-limit"].as<size_t>() > 0 &&
+			templates.size() > options["search-limit"].as<size_t>()) {
+			// Results are only truncated once filtered, so filtered templates don't take up places
+			templates.resize(options["search-limit"].as<size_t>());
 		}
-		if (templates.size() > 0) {
+		if (!search_query.empty() && templates.size() > 0) {
+			fmt::print("There are {0:d} templates matching \"{1:s}\":\n", templates.size(), search_query);
+		} else if (!search_query.empty()) {
+			fmt::print("There are no templates matching \"{0:s}\".\n", search_query);
+		} else if (templates.size() > 0) {
 			fmt::print("There are {0:d} templates installed:\n", templates.size());
 		} else {
 			fmt::print("There are no templates installed.\n", templates.size());
 			fmt::print("To install a template, visit the link: %s\n", string());
 		}
-		for (Template t : templates) {
-			string identifier = t.identifier();
-			string name = "(" + t.name() + ")";
+		for (const Template *t : templates) {
+			string identifier = t->identifier();
+			string name = "(" + t->name() + ")";
 
-			if (t.name().empty()) {
+			if (t->name().empty()) {
 				name.clear();
 			}
+			if (!search_query.empty() && !t->description().empty()) {
+				name += " - " + t->description();
+			}
 
 			fmt::print("	{0:s} {1:s}\n", identifier, name);
 		}
@@ -127,7 +280,7 @@ int main(int argc, char *argv[])
 	}
 
 	// Parse template by getting it from the library using it's pathname
-	Template _template = library.get(template_name);
+	const Template &_template = library.get(template_name);
 	
 	// Show template information only if "--info" is passed from command-line options
 	if (options.count("info")) {
@@ -136,38 +289,249 @@ int main(int argc, char *argv[])
 		fmt::print("	author: {0:s}\n", _template.author());
 		fmt::print("	path: {0:s}\n", _template.path());
 
+		if (!_template.description().empty()) {
+			fmt::print("	description: {0:s}\n", _template.description());
+		}
+		if (!_template.tags().empty()) {
+			fmt::print("	tags: {0:s}\n", fmt::join(_template.tags(), ", "));
+		}
+		if (!_template.bases().empty()) {
+			fmt::print("	base: {0:s}\n", fmt::join(_template.bases(), ", "));
+		}
+
 		if (!_template.runners().empty()) {
 			fmt::print("	runners:\n");
 		}
-		for (TemplateRunner runner : _template.runners()) {
+		for (const TemplateRunner &runner : _template.runners()) {
 			fmt::print("		{0:}\n", runner.path().filename());
 		}
+		if (!_template.project().filter().features().empty()) {
+			fmt::print("	features:\n");
+		}
+		for (const TemplateFeature &feature : _template.project().filter().features()) {
+			fmt::print("		{0:s} ({1:s})\n", feature.name, feature.enabled ? "enabled" : "disabled");
+		}
 
 		return EXIT_SUCCESS;
 	}
+	// List the template's files only if "--contents" is passed from command-line options
+	if (options.count("contents")) {
+		for (const string &pathname : _template.project().list()) {
+			fmt::print("{0:s}\n", pathname);
+		}
+
+		return EXIT_SUCCESS;
+	}
+	// Extract a single file only if "--pull" is passed from command-line options
+	if (!options["pull"].as<string>().empty()) {
+		filesystem::create_directories(output_path);
+		bool pulled = _template.project().pull(options["pull"].as<string>(), output_path.string());
+		return pulled ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	// Stream the project into an archive (or stdout with "-") instead of the output directory
+	string output_format_name = options["output-format"].as<string>();
+	ProjectStreamFormat output_format;
+
+	if (!ProjectStream::parse_format(output_format_name, output_format)) {
+		fmt::print("Unknown output format: {0:s}\n", output_format_name);
+		SystemRuntime::fatal();
+	}
+	if (options["output"].as<string>() == "-" && output_format == ProjectStreamFormat::directory) {
+		output_format = ProjectStreamFormat::tar;
+	}
+
+	bool output_stdout = options["output"].as<string>() == "-" || output_format_name == "-";
+	bool streamed = output_format != ProjectStreamFormat::directory;
+	ProjectStream output_stream = ProjectStream(output_stdout ? file_path("-") : output_path, output_format);
+
+	if (streamed && options.count("update")) {
+		fmt::print("Projects streamed into an archive cannot be updated.\n");
+		SystemRuntime::fatal();
+	}
+	if (streamed && !output_stdout && filesystem::is_directory(output_path)) {
+		fmt::print("Cannot stream the project into a directory: {0:s}\n", output_path);
+		SystemRuntime::fatal();
+	}
+	if (streamed && !options.count("plan") && !output_stream.open()) {
+		SystemRuntime::fatal();
+	}
+	// The project is configured before planning, so a plan shows exactly what would be generated
+	TemplateProject project = _template.project();
+	TemplateFilter filter = project.filter();
+	string store_link = options["store-link"].as<string>();
+	bool project_update = options.count("update") > 0;
+	ProjectDurability durability;
+
+	if (!ProjectStage::parse_durability(options["durability"].as<string>(), durability)) {
+		fmt::print("Unknown durability policy: {0:s}\n", options["durability"].as<string>());
+		SystemRuntime::fatal();
+	}
+
+	for (const string &feature : options["with"].as<vector<string>>()) {
+		if (!filter.enable(feature, true)) {
+			fmt::print("Template has no feature group named: {0:s}\n", feature);
+			SystemRuntime::fatal();
+		}
+	}
+	for (const string &feature : options["without"].as<vector<string>>()) {
+		if (!filter.enable(feature, false)) {
+			fmt::print("Template has no feature group named: {0:s}\n", feature);
+			SystemRuntime::fatal();
+		}
+	}
+
+	if (store_link == "copy") {
+		project.set_store_link(TemplateStoreLink::copy);
+	} else if (store_link == "hardlink") {
+		project.set_store_link(TemplateStoreLink::hardlink);
+	}
+
+	project.set_filter(filter);
+	project.set_buffer_size(options["buffer-size"].as<size_t>());
+	project.set_large_size(options["large-file-size"].as<uintmax_t>());
+	project.set_update(project_update);
+	project.set_verify(options.count("verify") > 0);
+
+	if (!options["metadata"].as<string>().empty()) {
+		TemplateMetadataPolicy metadata;
+
+		if (!TemplateMetadata::parse_policy(options["metadata"].as<string>(), metadata)) {
+			fmt::print("Unknown metadata policy: {0:s}\n", options["metadata"].as<string>());
+			SystemRuntime::fatal();
+		}
+
+		project.set_metadata(metadata);
+	}
+	project.set_threads(options["jobs"].as<unsigned>());
+
+	// Only print what would be generated if "--plan" is passed from command-line options,
+	// nothing is generated and no runner is executed
+	if (options.count("plan")) {
+		vector<TemplatePlanEntry> plan = options.count("skip-generator") ?
+			vector<TemplatePlanEntry>() : project.plan(output_path.string());
+		uintmax_t total_size = 0;
+		size_t files = 0;
+		size_t conflicts = 0;
+
+		if (!plan.empty()) {
+			fmt::print("Files:\n");
+		}
+		for (const TemplatePlanEntry &entry : plan) {
+			total_size += entry.size;
+			files += entry.directory ? 0 : 1;
+			conflicts += entry.conflict ? 1 : 0;
+			fmt::print("	{0:s}{1:s}\n", entry.path, entry.conflict ? " (exists)" : "");
+		}
+		if (!options.count("skip-generator")) {
+			fmt::print("Total: {0:d} files, {1:.1f} MiB\n", files, total_size / 1048576.0);
+		}
+		if (conflicts > 0) {
+			fmt::print("Conflicts with {0:d} existing files in {1:s}{2:s}\n", conflicts, output_path,
+				project_update ? ", modified files are kept" : ", they are overwritten");
+		}
+		if (!options.count("skip-runners") && !_template.runners().empty()) {
+			fmt::print("Runners:\n");
+
+			for (const TemplateRunner &runner : _template.runners()) {
+				fmt::print("	{0:}\n", runner.path());
+			}
+		}
+
+		return EXIT_SUCCESS;
+	}
+
 	// Generate and execute runners if "--skip-generate" isn't passed from command-line options
 	if (!options.count("skip-generator")) {
-		if (!filesystem::is_directory(output_path)) {
-			// Create directories if output directory is non-existent
-			fmt::print("Creating directory: {0:s}\n", output_path.stem());
-			filesystem::create_directories(output_path);
-		}
-		if (!_template.project().extract(output_path.string())) {
-			// Generate project using given template and extract the project data
-			fmt::print("Generate failure while extracting project data.\n");
+		if (streamed) {
+			// Streamed projects never touch the output directory
+			if (!project.stream(output_stream)) {
+				fmt::print("Generate failure while streaming project data.\n");
+				output_stream.abort();
+				SystemRuntime::fatal();
+			}
+		} else {
+			// New projects are generated into a staging directory and committed at once,
+			// existing projects (and updates) are written in place
+			ProjectStage stage = ProjectStage(output_path, durability);
+			bool staged = !project_update && stage.begin();
+
+			if (!staged && !filesystem::is_directory(output_path)) {
+				// Create directories if output directory is non-existent
+				fmt::print("Creating directory: {0:s}\n", output_path.stem());
+				filesystem::create_directories(output_path);
+			}
+			if (!project.extract(staged ? stage.path().string() : output_path.string())) {
+				// Generate project using given template and extract the project data
+				fmt::print("Generate failure while extracting project data.\n");
+				stage.abort();
+				SystemRuntime::fatal();
+			}
+			if (staged && !stage.commit()) {
+				SystemRuntime::fatal();
+			}
+			if (!staged) {
+				ProjectStage::sync(output_path, durability);
+			}
 		}
 	}
 	// Execute each runners if "--skip-runners" isn't passed from command-line options
 	if (!options.count("skip-runners")) {
+		RunnerCache runner_cache = RunnerCache(app_config.cache_path().string() + separator + "runners");
+		runner_cache.set_limit(app_config.cache_size());
+		unordered_map<string, filesystem::file_time_type> runner_inputs;
+		file_path runner_path = output_path;
+		error_code error;
+
+		if (streamed && !_template.runners().empty()) {
+			// Runners of streamed projects are executed in a temporary directory with their declared input files,
+			// the files they write are appended to the archive
+			vector<string> project_files = _template.project().list();
+			unordered_set<string> project_file_set = unordered_set<string>(project_files.begin(), project_files.end());
+			runner_path = filesystem::temp_directory_path().string() + separator + "proyekgen-runners-" +
+				to_string(steady_clock::now().time_since_epoch().count());
+			filesystem::create_directories(runner_path);
+
+			for (const TemplateRunner &runner : _template.runners()) {
+				for (const string &input : runner.inputs().files) {
+					if (!project_file_set.count(input) || runner_inputs.count(input)) {
+						continue;
+					}
+					if (_template.project().pull(input, runner_path.string())) {
+						runner_inputs[input] = filesystem::last_write_time(runner_path.string() + separator + input, error);
+					}
+				}
+			}
+		}
 		for (TemplateRunner runner : _template.runners()) {
 			// Temporarily change directory to output path
 			const file_path& cwd = SystemPaths::current_path();
-			chdir(output_path.string().c_str());
+			chdir(runner_path.string().c_str());
 			
-			// Execute runner, change directory back to current path when done
-			runner.execute();
+			// Execute runner (or restore its cached outputs), change directory back to current path when done
+			if (options.count("no-runner-cache")) {
+				runner.execute();
+			} else {
+				runner_cache.run(_template, runner, runner_path);
+			}
+
 			chdir(cwd.string().c_str());
 		}
+		if (streamed && runner_path != output_path) {
+			bool added = output_stream.add_directory(runner_path, runner_inputs);
+			filesystem::remove_all(runner_path, error);
+
+			if (!added) {
+				output_stream.abort();
+				SystemRuntime::fatal();
+			}
+		}
+	}
+	if (streamed && !output_stream.close()) {
+		SystemRuntime::fatal();
+	}
+	if (!TemplateEmbedded::contains(_template.path())) {
+		// Record the generation for prewarming the most used templates
+		TemplateUsage().record(filesystem::absolute(_template.path()));
 	}
 
 	return 0;
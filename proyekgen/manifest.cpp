@@ -0,0 +1,222 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "manifest.h"
+
+ProjectManifest::ProjectManifest(const file_path &root)
+	: _root(root)
+{}
+
+ProjectManifest::ProjectManifest()
+{}
+
+/*
+ * Returns the path of the manifest file.
+*/
+file_path ProjectManifest::path()
+{
+	return _root.string() + separator + ".proyekgen" + separator + "manifest.json";
+}
+
+/*
+ * Load the manifest from the generated project.
+ *
+ * Returns false if the project has no (readable) manifest.
+*/
+bool ProjectManifest::load()
+{
+	file_input stream(path());
+	json manifest_json;
+
+	if (!stream.is_open()) {
+		return false;
+	}
+
+	try {
+		manifest_json = json::parse(stream);
+	} catch (json::exception &ex) {
+		fmt::print("Cannot read project manifest {0:s}: {1:s}\n", path(), ex.what());
+		return false;
+	}
+
+	if (manifest_json.value("version", 0) != 2) {
+		// Older manifests list SHA-256 digests
+		return false;
+	}
+
+	json files = manifest_json.value("files", json::object());
+
+	for (auto &[pathname, file] : files.items()) {
+		ProjectManifestEntry entry;
+		entry.hash = file.value("hash", string());
+		entry.size = file.value("size", static_cast<uintmax_t>(0));
+		entry.mtime = file.value("mtime", static_cast<int64_t>(0));
+		_entries[pathname] = entry;
+	}
+
+	return true;
+}
+
+/*
+ * Save the manifest into the generated project.
+ *
+ * The manifest is written to a temporary file first, then renamed.
+*/
+bool ProjectManifest::save()
+{
+	json files = json::object();
+	file_path manifest_path = path();
+	file_path temp_path = manifest_path.string() + ".tmp";
+	error_code error;
+
+	for (const auto &[pathname, entry] : _entries) {
+		files[pathname] = {{"hash", entry.hash}, {"size", entry.size}, {"mtime", entry.mtime}};
+	}
+
+	filesystem::create_directories(manifest_path.parent_path(), error);
+	file_output stream(temp_path);
+
+	if (!stream.is_open()) {
+		fmt::print("Cannot write project manifest: {0:s}\n", manifest_path);
+		return false;
+	}
+
+	stream << json({{"version", 2}, {"files", files}}).dump(1, '\t');
+	stream.close();
+	filesystem::rename(temp_path, manifest_path, error);
+	return !error;
+}
+
+/*
+ * Compare a template file against the file in the generated project.
+*/
+ProjectManifestStatus ProjectManifest::compare(const string &pathname, const string &hash)
+{
+	ProjectManifestStatus status;
+	string current = disk_hash(pathname);
+	auto recorded = _entries.find(pathname);
+
+	if (current.empty()) {
+		status = ProjectManifestStatus::created;
+	} else if (current == hash) {
+		status = ProjectManifestStatus::unchanged;
+	} else if (recorded != _entries.end() && recorded->second.hash == current) {
+		status = ProjectManifestStatus::updated;
+	} else if (recorded != _entries.end() && recorded->second.hash == hash) {
+		status = ProjectManifestStatus::modified;
+	} else {
+		status = ProjectManifestStatus::conflict;
+	}
+
+	_seen.insert(pathname);
+	_counts[static_cast<int>(status)]++;
+	return status;
+}
+
+/*
+ * Record a file that was written into the generated project.
+*/
+void ProjectManifest::record(const string &pathname, const string &hash)
+{
+	file_path file = _root.string() + separator + pathname;
+	ProjectManifestEntry entry;
+	error_code error;
+
+	entry.hash = hash;
+	entry.size = filesystem::file_size(file, error);
+	entry.mtime = filesystem::last_write_time(file, error).time_since_epoch().count();
+	_entries[pathname] = entry;
+	_seen.insert(pathname);
+}
+
+/*
+ * Remove the files that are no longer part of the template.
+ *
+ * Manifest entries that were neither compared nor recorded since the manifest
+ * was loaded are dropped. Their files are deleted (with any directories left
+ * empty) unless they were modified locally, in which case they are kept.
+*/
+void ProjectManifest::prune()
+{
+	for (auto entry = _entries.begin(); entry != _entries.end();) {
+		if (_seen.count(entry->first)) {
+			entry++;
+			continue;
+		}
+
+		file_path file = _root.string() + separator + entry->first;
+		string current = disk_hash(entry->first);
+		error_code error;
+
+		if (current == entry->second.hash) {
+			fmt::print("Removing file: {0:s}\n", entry->first);
+			filesystem::remove(file, error);
+
+			if (error) {
+				fmt::print("Cannot remove file {0:s}: {1:s}\n", entry->first, error.message());
+			} else {
+				_removed++;
+			}
+
+			// Only empty directories are removed, remove() fails on anything else
+			for (file_path parent = file.parent_path(); !error && parent != _root &&
+				parent.string().size() > _root.string().size(); parent = parent.parent_path()) {
+				filesystem::remove(parent, error);
+			}
+		} else if (!current.empty()) {
+			fmt::print("Keeping removed file: {0:s} was modified locally\n", entry->first);
+		}
+
+		entry = _entries.erase(entry);
+	}
+}
+
+/*
+ * Returns a summary of the compared files.
+*/
+string ProjectManifest::summary()
+{
+	return fmt::format("{0:d} new, {1:d} updated, {2:d} unchanged, {3:d} modified locally, {4:d} conflicts, {5:d} removed",
+		_counts[0], _counts[2], _counts[1], _counts[3], _counts[4], _removed);
+}
+
+/*
+ * Internally used by the compare function
+ *
+ * Files whose size and modification time still match the manifest are not re-hashed.
+*/
+string ProjectManifest::disk_hash(const string &pathname)
+{
+	file_path file = _root.string() + separator + pathname;
+	auto recorded = _entries.find(pathname);
+	error_code error;
+
+	if (!filesystem::is_regular_file(file)) {
+		return string();
+	}
+	if (recorded != _entries.end()) {
+		uintmax_t size = filesystem::file_size(file, error);
+		int64_t mtime = filesystem::last_write_time(file, error).time_since_epoch().count();
+
+		if (!error && size == recorded->second.size && mtime == recorded->second.mtime) {
+			return recorded->second.hash;
+		}
+	}
+
+	return HashXxh3::file(file);
+}
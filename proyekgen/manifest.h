@@ -0,0 +1,76 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "hash.h"
+
+/*
+ * A file recorded in the manifest of a generated project.
+*/
+struct ProjectManifestEntry
+{
+	string hash;
+	uintmax_t size = 0;
+	int64_t mtime = 0;
+};
+
+/*
+ * The result of comparing a template file against the generated project.
+ *
+ * A file is "modified" if only the user changed it, and a "conflict"
+ * if both the user and the template changed it.
+*/
+enum class ProjectManifestStatus
+{
+	created,
+	unchanged,
+	updated,
+	modified,
+	conflict
+};
+
+/*
+ * A class that keeps track of the files written into a generated project.
+ *
+ * The manifest is stored as .proyekgen/manifest.json inside the project, it maps
+ * paths to XXH3 content hashes so regenerating with --update only touches changed files.
+*/
+class ProjectManifest
+{
+public:
+	ProjectManifest(const file_path &root);
+	ProjectManifest();
+
+	file_path path();
+	bool load();
+	bool save();
+	ProjectManifestStatus compare(const string &pathname, const string &hash);
+	void record(const string &pathname, const string &hash);
+	void prune();
+	string summary();
+
+private:
+	string disk_hash(const string &pathname);
+
+	file_path _root;
+	unordered_map<string, ProjectManifestEntry> _entries;
+	unordered_set<string> _seen;
+	size_t _counts[5] = {};
+	size_t _removed = 0;
+};
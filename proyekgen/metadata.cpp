@@ -0,0 +1,172 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "metadata.h"
+
+#if defined(__linux__)
+#include "grp.h"
+#include "pwd.h"
+#endif
+
+/*
+ * Parse the name of a metadata policy.
+ *
+ * Returns false if the name is unknown.
+*/
+bool TemplateMetadata::parse_policy(const string &name, TemplateMetadataPolicy &policy)
+{
+	if (name == "minimal") {
+		policy = TemplateMetadataPolicy::minimal;
+	} else if (name == "standard") {
+		policy = TemplateMetadataPolicy::standard;
+	} else if (name == "full") {
+		policy = TemplateMetadataPolicy::full;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Returns the options of the libarchive disk writer for a metadata policy.
+*/
+int TemplateMetadata::extract_flags(TemplateMetadataPolicy policy)
+{
+	// Whatever the policy, entries with ".." or absolute paths and entries that would be written
+	// through a symlink (from the archive or already on disk) are refused
+	int flags = ARCHIVE_EXTRACT_SECURE_NODOTDOT | ARCHIVE_EXTRACT_SECURE_NOABSOLUTEPATHS |
+		ARCHIVE_EXTRACT_SECURE_SYMLINKS;
+
+	if (policy != TemplateMetadataPolicy::minimal) {
+		flags |= ARCHIVE_EXTRACT_TIME;
+		flags |= ARCHIVE_EXTRACT_PERM;
+	}
+	if (policy == TemplateMetadataPolicy::full) {
+		flags |= ARCHIVE_EXTRACT_ACL;
+		flags |= ARCHIVE_EXTRACT_FFLAGS;
+	}
+
+	return flags;
+}
+
+/*
+ * Set the owner and group lookups of a libarchive disk writer.
+ *
+ * The writer looks up the owner of every entry, only the full policy resolves
+ * them and each name is only resolved once. Other policies keep the stored IDs.
+*/
+void TemplateMetadata::set_lookup(struct archive *writer, TemplateMetadataPolicy policy)
+{
+	if (policy == TemplateMetadataPolicy::full) {
+		archive_write_disk_set_user_lookup(writer, nullptr, lookup_user, nullptr);
+		archive_write_disk_set_group_lookup(writer, nullptr, lookup_group, nullptr);
+	}
+}
+
+/*
+ * Apply the metadata of an extracted file according to a metadata policy.
+ *
+ * The minimal policy only changes the mode of files with execute bits,
+ * other files keep the mode they were created with.
+*/
+void TemplateMetadata::apply(const file_path &target, uint32_t mode, time_t mtime, TemplateMetadataPolicy policy)
+{
+	error_code error;
+
+	if (policy != TemplateMetadataPolicy::minimal) {
+		filesystem::permissions(target, static_cast<filesystem::perms>(mode & 07777), error);
+	} else if ((mode & 0111) != 0) {
+		filesystem::permissions(target, static_cast<filesystem::perms>(mode & 0777), error);
+	}
+#if defined(__linux__)
+	if (policy != TemplateMetadataPolicy::minimal) {
+		struct timespec times[2] = {};
+		times[0].tv_sec = times[1].tv_sec = mtime;
+		utimensat(AT_FDCWD, target.string().c_str(), times, 0);
+	}
+#endif
+}
+
+/*
+ * Internally used by the set_lookup function
+ *
+ * Names that can't be resolved are cached too, the ID stored in the entry is used for them.
+*/
+la_int64_t TemplateMetadata::lookup_user(void *data, const char *name, la_int64_t id)
+{
+	static unordered_map<string, la_int64_t> users;
+	static mutex users_mutex;
+	la_int64_t resolved = -1;
+
+	if (name == nullptr || name[0] == '\0') {
+		return id;
+	}
+
+	lock_guard lock(users_mutex);
+	auto user = users.find(name);
+
+	if (user != users.end()) {
+		return (user->second >= 0) ? user->second : id;
+	}
+#if defined(__linux__)
+	struct passwd entry;
+	struct passwd *result = nullptr;
+	vector<char> buffer(16384);
+
+	if (getpwnam_r(name, &entry, buffer.data(), buffer.size(), &result) == 0 && result != nullptr) {
+		resolved = static_cast<la_int64_t>(result->pw_uid);
+	}
+#endif
+
+	users[name] = resolved;
+	return (resolved >= 0) ? resolved : id;
+}
+
+/*
+ * Internally used by the set_lookup function
+*/
+la_int64_t TemplateMetadata::lookup_group(void *data, const char *name, la_int64_t id)
+{
+	static unordered_map<string, la_int64_t> groups;
+	static mutex groups_mutex;
+	la_int64_t resolved = -1;
+
+	if (name == nullptr || name[0] == '\0') {
+		return id;
+	}
+
+	lock_guard lock(groups_mutex);
+	auto group = groups.find(name);
+
+	if (group != groups.end()) {
+		return (group->second >= 0) ? group->second : id;
+	}
+#if defined(__linux__)
+	struct group entry;
+	struct group *result = nullptr;
+	vector<char> buffer(16384);
+
+	if (getgrnam_r(name, &entry, buffer.data(), buffer.size(), &result) == 0 && result != nullptr) {
+		resolved = static_cast<la_int64_t>(result->gr_gid);
+	}
+#endif
+
+	groups[name] = resolved;
+	return (resolved >= 0) ? resolved : id;
+}
@@ -0,0 +1,51 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+
+/*
+ * How much file metadata is restored when a template project is extracted.
+ *
+ * "full" restores modification times, permissions, ACLs and file flags,
+ * "standard" restores modification times and permissions,
+ * "minimal" only keeps the mode bits, files are created under the umask
+ * and timestamps are left to the time of the generation.
+*/
+enum class TemplateMetadataPolicy
+{
+	minimal,
+	standard,
+	full
+};
+
+/*
+ * Functions for restoring the metadata of extracted files according to a policy.
+*/
+class TemplateMetadata
+{
+public:
+	static bool parse_policy(const string &name, TemplateMetadataPolicy &policy);
+	static int extract_flags(TemplateMetadataPolicy policy);
+	static void set_lookup(struct archive *writer, TemplateMetadataPolicy policy);
+	static void apply(const file_path &target, uint32_t mode, time_t mtime, TemplateMetadataPolicy policy);
+
+private:
+	static la_int64_t lookup_user(void *data, const char *name, la_int64_t id);
+	static la_int64_t lookup_group(void *data, const char *name, la_int64_t id);
+};
@@ -0,0 +1,471 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "pack.h"
+
+// Files larger than a frame are split into frames of this size when packing for mirrors
+static const size_t pack_frame_size = 4 * 1024 * 1024;
+
+/*
+ * Compress the first size bytes of the pending tar data into a zstd frame of their own.
+*/
+static bool pack_flush_frame(TemplatePackFrames &frames, size_t size)
+{
+	struct archive *writer = archive_write_new();
+	struct archive_entry *entry = archive_entry_new();
+	vector<char> compressed(size + size / 2 + 65536);
+	size_t used = 0;
+	int result;
+
+	if (size == 0) {
+		archive_entry_free(entry);
+		archive_write_free(writer);
+		return true;
+	}
+
+	archive_write_add_filter_zstd(writer);
+	archive_write_set_format_raw(writer);
+	archive_write_set_bytes_in_last_block(writer, 1);
+	result = archive_write_open_memory(writer, compressed.data(), compressed.size(), &used);
+	archive_entry_set_pathname(entry, "frame");
+	archive_entry_set_filetype(entry, AE_IFREG);
+	archive_entry_set_size(entry, static_cast<la_int64_t>(size));
+
+	if (result == ARCHIVE_OK) {
+		result = archive_write_header(writer, entry);
+	}
+	if (result == ARCHIVE_OK && archive_write_data(writer, frames.pending.data(), size) < 0) {
+		result = ARCHIVE_FATAL;
+	}
+	if (result == ARCHIVE_OK) {
+		result = archive_write_close(writer);
+	}
+
+	archive_entry_free(entry);
+	archive_write_free(writer);
+
+	if (result != ARCHIVE_OK) {
+		return false;
+	}
+
+	frames.stream.write(compressed.data(), static_cast<std::streamsize>(used));
+	frames.pending.erase(frames.pending.begin(), frames.pending.begin() + static_cast<std::ptrdiff_t>(size));
+	return static_cast<bool>(frames.stream);
+}
+
+/*
+ * Registered as the write callback of the tar writer when packing for mirrors
+*/
+static la_ssize_t pack_write_frames(struct archive *, void *data, const void *buffer, size_t size)
+{
+	TemplatePackFrames &frames = *static_cast<TemplatePackFrames*>(data);
+	frames.pending.insert(frames.pending.end(), static_cast<const char*>(buffer),
+		static_cast<const char*>(buffer) + size);
+
+	while (frames.pending.size() >= pack_frame_size) {
+		if (!pack_flush_frame(frames, pack_frame_size)) {
+			return -1;
+		}
+	}
+
+	return static_cast<la_ssize_t>(size);
+}
+
+TemplatePacker::TemplatePacker(const file_path &source)
+	: _source(source.lexically_normal())
+{
+	if (_source.filename().empty()) {
+		// Drop the trailing separator of the source directory
+		_source = _source.parent_path();
+	}
+
+	// Reproducible builds pin timestamps through SOURCE_DATE_EPOCH, everything else uses the epoch
+	const char *source_date_epoch = getenv("SOURCE_DATE_EPOCH");
+
+	if (source_date_epoch != nullptr) {
+		_mtime = static_cast<time_t>(std::strtoll(source_date_epoch, nullptr, 10));
+	}
+}
+
+/*
+ * Set the compression of the project data (xz or zstd).
+*/
+void TemplatePacker::set_format(const string &format)
+{
+	_format = format;
+}
+
+/*
+ * Set the number of threads used for reading and compressing, zero uses every available core.
+*/
+void TemplatePacker::set_threads(unsigned threads)
+{
+	_threads = threads;
+}
+
+/*
+ * Set if the project data is packed for installing from a mirror (zstd only).
+ *
+ * Every file is compressed into zstd frames of its own, so an unchanged file compresses
+ * to the same bytes in every version and the chunks of a mirror update only cover changed files.
+ * The frames are compressed on a single thread.
+*/
+void TemplatePacker::set_mirror(bool mirror)
+{
+	_mirror = mirror;
+}
+
+/*
+ * Returns the file name of the packed project data.
+*/
+string TemplatePacker::archive_name()
+{
+	return (_format == "zstd") ? "project.tar.zst" : "project.tar.xz";
+}
+
+/*
+ * Pack the source directory into the project data of a template directory.
+ *
+ * An info.json skeleton is created if the template has none yet,
+ * the file digests of an existing info.json are replaced. The chunk index
+ * of the template directory is written last, for installing it from a mirror.
+*/
+bool TemplatePacker::pack(const file_path &destination)
+{
+	vector<TemplatePackEntry> entries;
+	file_path archive_path = destination.string() + separator + archive_name();
+	file_path temp_path = archive_path.string() + ".tmp";
+	unsigned threads = (_threads > 0) ? _threads : std::max(thread::hardware_concurrency(), 1u);
+	// Batches of files are read in parallel, their data is kept in memory until written
+	const uintmax_t batch_size = 64 * 1024 * 1024;
+	HashSha256 digest;
+	TemplatePackFrames frames;
+	error_code error;
+	atomic<bool> failed{false};
+
+	if (_format != "xz" && _format != "zstd") {
+		fmt::print("Unknown archive format: {0:s}\n", _format);
+		return false;
+	}
+	if (_mirror && _format != "zstd") {
+		fmt::print("Project data for mirrors is only supported with the zstd format\n");
+		return false;
+	}
+	if (!scan(entries)) {
+		return false;
+	}
+
+	filesystem::create_directories(destination, error);
+	struct archive *writer = archive_write_new();
+	archive_write_set_format_pax_restricted(writer);
+
+	// The multi-threaded encoders split the data into independently decodable blocks (xz) or
+	// frames (zstd) of a fixed input size, their output doesn't depend on the number of threads
+	// as long as there is more than one. For mirrors, every entry is compressed into frames of its own
+	// instead, so an unchanged file compresses to the same bytes wherever it is in the archive
+	if (_mirror) {
+		frames.stream.open(temp_path, std::ios::binary | std::ios::trunc);
+		archive_write_set_bytes_per_block(writer, 0);
+	} else if (_format == "zstd") {
+		archive_write_add_filter_zstd(writer);
+		archive_write_set_filter_option(writer, "zstd", "threads", to_string(std::max(threads, 1u)).c_str());
+
+		if (archive_write_set_filter_option(writer, "zstd", "max-frame-in", "4194304") != ARCHIVE_OK) {
+			fmt::print("This libarchive can't split zstd frames, the project data is a single frame\n");
+		}
+	} else {
+		archive_write_add_filter_xz(writer);
+		archive_write_set_filter_option(writer, "xz", "threads", to_string(std::max(threads, 2u)).c_str());
+	}
+	if ((_mirror && (!frames.stream.is_open() ||
+		archive_write_open2(writer, &frames, nullptr, pack_write_frames, nullptr, nullptr) != ARCHIVE_OK)) ||
+		(!_mirror && archive_write_open_filename(writer, temp_path.string().c_str()) != ARCHIVE_OK)) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", temp_path, archive_error_string(writer));
+		archive_write_free(writer);
+		return false;
+	}
+	for (size_t first = 0; first < entries.size() && !failed;) {
+		size_t last = first;
+		uintmax_t size = 0;
+
+		while (last < entries.size() && (last == first || size + entries[last].size <= batch_size)) {
+			size += (entries[last].type == AE_IFREG) ? entries[last].size : 0;
+			last++;
+		}
+
+		SystemRuntime::parallel(last - first, threads, [&](size_t i) {
+			TemplatePackEntry &entry = entries[first + i];
+
+			if (entry.type != AE_IFREG || entry.size > batch_size) {
+				// Files larger than a batch are streamed while writing
+				return;
+			}
+
+			file_input stream(entry.source, std::ios::binary);
+			HashDigest hash(true, true);
+			entry.data.resize(static_cast<size_t>(entry.size));
+			stream.read(entry.data.data(), entry.data.size());
+
+			if (!stream.is_open() || static_cast<uintmax_t>(stream.gcount()) != entry.size) {
+				fmt::print("Cannot read {0:s}: {1:s}\n", entry.source, stream.is_open() ?
+					"the file is shorter than when it was listed" : strerror(errno));
+				failed = true;
+				return;
+			}
+
+			hash.update(entry.data.data(), entry.data.size());
+			entry.hash = hash.sha256();
+			entry.checksum = hash.xxh3();
+		});
+
+		// Entries read in this batch are only written if every read succeeded
+		for (size_t i = first; i < last && !failed; i++) {
+			failed = !write(writer, entries[i]) || (_mirror && !pack_flush_frame(frames, frames.pending.size()));
+			digest.update(entries[i].path + ":" + to_string(entries[i].mode) + ":" +
+				entries[i].link + entries[i].hash + "\n");
+		}
+
+		first = last;
+	}
+
+	failed = (archive_write_close(writer) != ARCHIVE_OK) || failed;
+	archive_write_free(writer);
+
+	if (_mirror) {
+		// The end of the archive is the last frame
+		failed = !pack_flush_frame(frames, frames.pending.size()) || failed;
+		frames.stream.close();
+		failed = !frames.stream || failed;
+	}
+
+	if (failed) {
+		filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	filesystem::rename(temp_path, archive_path, error);
+
+	if (error) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", archive_path, error.message());
+		return false;
+	}
+
+	fmt::print("Packed {0:d} entries into {1:s}\n", entries.size(), archive_path);
+	fmt::print("Content digest: {0:s}\n", digest.finish());
+	return write_info(destination, entries) && TemplateSync::write_index(destination);
+}
+
+/*
+ * Internally used by the pack function
+ *
+ * Collects the entries of the source directory sorted by their paths,
+ * symlinks are packed as links instead of being followed.
+*/
+bool TemplatePacker::scan(vector<TemplatePackEntry> &entries)
+{
+	error_code error;
+
+	if (!filesystem::is_directory(_source)) {
+		fmt::print("Cannot find directory: {0:s}\n", _source);
+		return false;
+	}
+
+	filesystem::recursive_directory_iterator it{ _source, error };
+
+	for (; !error && it != filesystem::recursive_directory_iterator(); it.increment(error)) {
+		TemplatePackEntry entry;
+		filesystem::file_status status = it->symlink_status(error);
+		entry.source = it->path();
+		entry.path = it->path().lexically_relative(_source).generic_string();
+
+		if (it->path().filename() == ".proyekgen") {
+			// Manifests of generated projects aren't part of a template
+			it.disable_recursion_pending();
+			continue;
+		}
+		if (filesystem::is_symlink(status)) {
+			entry.type = AE_IFLNK;
+			entry.mode = 0777;
+			entry.link = filesystem::read_symlink(it->path(), error).string();
+		} else if (filesystem::is_directory(status)) {
+			entry.type = AE_IFDIR;
+			entry.mode = 0755;
+			entry.path += "/";
+		} else if (filesystem::is_regular_file(status)) {
+			bool executable = (status.permissions() & filesystem::perms::owner_exec) != filesystem::perms::none;
+			entry.type = AE_IFREG;
+			entry.mode = executable ? 0755 : 0644;
+			entry.size = filesystem::file_size(it->path(), error);
+		} else {
+			fmt::print("Skipping unsupported entry: {0:s}\n", entry.path);
+			continue;
+		}
+
+		entries.push_back(entry);
+	}
+	if (error) {
+		fmt::print("Cannot read directory {0:s}: {1:s}\n", _source, error.message());
+		return false;
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const TemplatePackEntry &a, const TemplatePackEntry &b) {
+		return a.path < b.path;
+	});
+
+	return true;
+}
+
+/*
+ * Internally used by the pack function
+ *
+ * Ownership is dropped and timestamps are pinned, only the permissions are kept.
+*/
+bool TemplatePacker::write(struct archive *writer, TemplatePackEntry &entry)
+{
+	struct archive_entry *archive_entry = archive_entry_new();
+	bool written = true;
+
+	archive_entry_set_pathname(archive_entry, entry.path.c_str());
+	archive_entry_set_filetype(archive_entry, entry.type);
+	archive_entry_set_perm(archive_entry, entry.mode);
+	archive_entry_set_mtime(archive_entry, _mtime, 0);
+	archive_entry_set_uid(archive_entry, 0);
+	archive_entry_set_gid(archive_entry, 0);
+	archive_entry_set_size(archive_entry, static_cast<la_int64_t>(entry.type == AE_IFREG ? entry.size : 0));
+
+	if (entry.type == AE_IFLNK) {
+		archive_entry_set_symlink(archive_entry, entry.link.c_str());
+	}
+	if (archive_write_header(writer, archive_entry) != ARCHIVE_OK) {
+		fmt::print("Cannot pack {0:s}: {1:s}\n", entry.path, archive_error_string(writer));
+		archive_entry_free(archive_entry);
+		return false;
+	}
+	if (entry.type == AE_IFREG && entry.data.size() == entry.size) {
+		written = archive_write_data(writer, entry.data.data(), entry.data.size()) ==
+			static_cast<la_ssize_t>(entry.data.size());
+	} else if (entry.type == AE_IFREG) {
+		file_input stream(entry.source, std::ios::binary);
+		vector<char> buffer(1024 * 1024);
+		HashDigest hash(true, true);
+
+		if (!stream.is_open()) {
+			fmt::print("Cannot read {0:s}: {1:s}\n", entry.source, strerror(errno));
+			archive_entry_free(archive_entry);
+			return false;
+		}
+
+		// Exactly the size in the entry's header is read, a file that shrank since it was listed fails
+		for (uintmax_t remaining = entry.size; written && remaining > 0;) {
+			stream.read(buffer.data(), static_cast<std::streamsize>(std::min<uintmax_t>(remaining, buffer.size())));
+			size_t count = static_cast<size_t>(stream.gcount());
+
+			if (count == 0) {
+				fmt::print("Cannot read {0:s}: the file is shorter than when it was listed\n", entry.source);
+				archive_entry_free(archive_entry);
+				return false;
+			}
+
+			hash.update(buffer.data(), count);
+			written = archive_write_data(writer, buffer.data(), count) == static_cast<la_ssize_t>(count);
+			remaining -= count;
+		}
+
+		entry.hash = hash.sha256();
+		entry.checksum = hash.xxh3();
+	}
+
+	// The padding of the entry is written now, so it isn't part of the next entry's data
+	if (written && archive_write_finish_entry(writer) != ARCHIVE_OK) {
+		written = false;
+	}
+
+	// Data is released as soon as it's written
+	entry.data = vector<char>();
+	archive_entry_free(archive_entry);
+
+	if (!written) {
+		fmt::print("Cannot pack {0:s}: {1:s}\n", entry.path, archive_error_string(writer));
+	}
+
+	return written;
+}
+
+/*
+ * Internally used by the pack function
+ *
+ * Digests use XXH3 unless the existing info.json asks for SHA-256,
+ * the other members of an existing info.json are kept in their order.
+*/
+bool TemplatePacker::write_info(const file_path &destination, const vector<TemplatePackEntry> &entries)
+{
+	file_path info_path = destination.string() + separator + "info.json";
+	file_path temp_path = info_path.string() + ".tmp";
+	const char *user = getenv("USER");
+	bool exists = filesystem::exists(info_path);
+	ordered_json info;
+	ordered_json files = ordered_json::object();
+	TemplateDigestAlgorithm algorithm = TemplateDigestAlgorithm::xxh3;
+	error_code error;
+
+	if (exists) {
+		file_input info_stream(info_path);
+
+		try {
+			info = ordered_json::parse(info_stream);
+		} catch (json::exception &ex) {
+			fmt::print("Cannot read {0:s}: {1:s}\n", info_path, ex.what());
+			return false;
+		}
+		if (info.contains("digests") && info["digests"].is_object()) {
+			TemplateDigests::parse_algorithm(info["digests"].value("algorithm", string()), algorithm);
+		}
+	} else {
+		info = {{"name", _source.filename().string()}, {"author", (user != nullptr) ? user : "unknown"},
+			{"description", string()}, {"tags", ordered_json::array()}, {"runners", ordered_json::array()}};
+	}
+	for (const TemplatePackEntry &entry : entries) {
+		if (entry.type == AE_IFREG) {
+			files[entry.path] = (algorithm == TemplateDigestAlgorithm::sha256) ? entry.hash : entry.checksum;
+		}
+	}
+
+	info["digests"] = {{"algorithm", (algorithm == TemplateDigestAlgorithm::sha256) ? "sha256" : "xxh3"},
+		{"files", files}};
+	file_output stream(temp_path);
+	stream << info.dump(1, '\t') << "\n";
+	stream.close();
+
+	if (!stream) {
+		fmt::print("Cannot write {0:s}\n", info_path);
+		filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	filesystem::rename(temp_path, info_path, error);
+
+	if (error) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", info_path, error.message());
+		return false;
+	}
+	if (!exists) {
+		fmt::print("Created info.json skeleton: {0:s}\n", info_path);
+	}
+
+	return true;
+}
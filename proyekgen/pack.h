@@ -0,0 +1,83 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "digest.h"
+#include "hash.h"
+#include "sync.h"
+#include "system.h"
+
+/*
+ * A file of a template project being packed.
+*/
+struct TemplatePackEntry
+{
+	string path;
+	file_path source;
+	int type = 0;
+	int mode = 0;
+	uintmax_t size = 0;
+	string link;
+	string hash;
+	string checksum;
+	vector<char> data;
+};
+
+/*
+ * Project data packed for mirrors, written as a series of zstd frames.
+ *
+ * The tar data of every entry is collected in pending and compressed into frames of its own
+ * once the entry is written, large files are split into frames at fixed offsets.
+*/
+struct TemplatePackFrames
+{
+	file_output stream;
+	vector<char> pending;
+};
+
+/*
+ * A class that packs a directory into the project data of a template.
+ *
+ * Entries are written in a stable order with normalized metadata, so packing the same
+ * files twice results in the same archive. Files are read and hashed on a pool of threads
+ * and compressed by a multi-threaded xz (or zstd) encoder. The file digests are written
+ * into the template's info.json, so extracted files can be checked.
+*/
+class TemplatePacker
+{
+public:
+	TemplatePacker(const file_path &source);
+
+	void set_format(const string &format);
+	void set_threads(unsigned threads);
+	void set_mirror(bool mirror);
+	string archive_name();
+	bool pack(const file_path &destination);
+
+private:
+	bool scan(vector<TemplatePackEntry> &entries);
+	bool write(struct archive *writer, TemplatePackEntry &entry);
+	bool write_info(const file_path &destination, const vector<TemplatePackEntry> &entries);
+
+	file_path _source;
+	string _format = "xz";
+	unsigned _threads = 0;
+	bool _mirror = false;
+	time_t _mtime = 0;
+};
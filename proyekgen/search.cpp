@@ -0,0 +1,148 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "search.h"
+
+TemplateSearch::TemplateSearch(const vector<Template> &templates)
+{
+	for (size_t i = 0; i < templates.size(); i++) {
+		const Template &t = templates[i];
+		uint32_t position = static_cast<uint32_t>(i);
+
+		// Matches in identifiers count the most, descriptions the least
+		add(position, t.identifier(), 6);
+		add(position, t.name(), 4);
+		add(position, t.author(), 2);
+		add(position, t.description(), 1);
+
+		for (const string &tag : t.tags()) {
+			add(position, tag, 4);
+		}
+
+		_identifiers.push_back(lowercase(t.identifier()));
+		_names.push_back(lowercase(t.name()));
+	}
+}
+
+TemplateSearch::TemplateSearch()
+{}
+
+/*
+ * Returns the positions of the templates matching a query, best matches first.
+ *
+ * A template matches if it shares at least a third of the query's trigrams,
+ * identifiers and names containing the query rank above fuzzy matches.
+ * A limit of zero returns every match.
+*/
+vector<size_t> TemplateSearch::search(const string &query, size_t limit) const
+{
+	vector<uint32_t> query_trigrams = trigrams(query);
+	unordered_map<uint32_t, pair<uint32_t, uint32_t>> scores;
+	vector<pair<uint32_t, uint32_t>> ranked;
+	vector<size_t> result;
+	string query_lowercase = lowercase(query);
+
+	for (uint32_t trigram : query_trigrams) {
+		auto it = _index.find(trigram);
+
+		if (it == _index.end()) {
+			continue;
+		}
+
+		// Every template has a single posting per trigram, weighted by the fields containing it
+		for (const Posting &posting : it->second) {
+			pair<uint32_t, uint32_t> &score = scores[posting.position];
+			score.first += posting.weight;
+			score.second++;
+		}
+	}
+	for (const pair<const uint32_t, pair<uint32_t, uint32_t>> &score : scores) {
+		if (score.second.second * 3 < query_trigrams.size()) {
+			continue;
+		}
+
+		uint32_t total = score.second.first;
+
+		if (_identifiers[score.first].find(query_lowercase) != string::npos) {
+			total += 1000;
+		} else if (_names[score.first].find(query_lowercase) != string::npos) {
+			total += 500;
+		}
+
+		ranked.push_back({score.first, total});
+	}
+
+	// Equal scores keep the library order
+	std::sort(ranked.begin(), ranked.end(), [](const pair<uint32_t, uint32_t> &a, const pair<uint32_t, uint32_t> &b) {
+		return (a.second != b.second) ? a.second > b.second : a.first < b.first;
+	});
+
+	for (size_t i = 0; i < ranked.size() && (limit == 0 || i < limit); i++) {
+		result.push_back(ranked[i].first);
+	}
+
+	return result;
+}
+
+/*
+ * Internally used by the constructor
+*/
+void TemplateSearch::add(uint32_t position, const string &text, uint32_t weight)
+{
+	for (uint32_t trigram : trigrams(text)) {
+		vector<Posting> &postings = _index[trigram];
+
+		if (!postings.empty() && postings.back().position == position) {
+			postings.back().weight += weight;
+		} else {
+			postings.push_back({position, weight});
+		}
+	}
+}
+
+/*
+ * Internally used by the search function
+ *
+ * Returns the distinct trigrams of a lowercased text, padded so short texts still have trigrams.
+*/
+vector<uint32_t> TemplateSearch::trigrams(const string &text)
+{
+	string padded = "  " + lowercase(text) + " ";
+	vector<uint32_t> result;
+
+	for (size_t i = 0; i + 3 <= padded.size(); i++) {
+		result.push_back(static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16 |
+			static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8 |
+			static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 2])));
+	}
+
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+	return result;
+}
+
+/*
+ * Internally used by the search function
+*/
+string TemplateSearch::lowercase(const string &text)
+{
+	string result = text;
+	transform(result.begin(), result.end(), result.begin(),
+		[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return result;
+}
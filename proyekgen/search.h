@@ -0,0 +1,51 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "template.h"
+
+/*
+ * A class that ranks templates by fuzzy matching a query.
+ *
+ * The identifier, name, author, tags and description of every template are split
+ * into trigrams once, a query only visits the templates sharing trigrams with it.
+*/
+class TemplateSearch
+{
+public:
+	TemplateSearch(const vector<Template> &templates);
+	TemplateSearch();
+
+	vector<size_t> search(const string &query, size_t limit = 0) const;
+
+private:
+	struct Posting
+	{
+		uint32_t position;
+		uint32_t weight;
+	};
+
+	void add(uint32_t position, const string &text, uint32_t weight);
+	static vector<uint32_t> trigrams(const string &text);
+	static string lowercase(const string &text);
+
+	unordered_map<uint32_t, vector<Posting>> _index;
+	vector<string> _identifiers;
+	vector<string> _names;
+};
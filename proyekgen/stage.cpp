@@ -0,0 +1,185 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "stage.h"
+
+ProjectStage::ProjectStage(const file_path &output, ProjectDurability durability)
+	: _output(output.lexically_normal()), _durability(durability)
+{
+	if (_output.filename().empty()) {
+		// Drop the trailing separator of the output directory
+		_output = _output.parent_path();
+	}
+}
+
+/*
+ * Returns the staging directory, or an empty path if the project isn't staged.
+*/
+file_path ProjectStage::path()
+{
+	return _path;
+}
+
+/*
+ * Create the staging directory.
+ *
+ * Only outputs that don't exist yet (or empty directories other than the current directory)
+ * can be staged, returns false if the project has to be generated in place.
+*/
+bool ProjectStage::begin()
+{
+	file_path parent = _output.parent_path();
+	error_code error;
+
+	if (filesystem::exists(_output) && (!filesystem::is_directory(_output) ||
+		!filesystem::is_empty(_output, error) || filesystem::equivalent(_output, filesystem::current_path(), error))) {
+		return false;
+	}
+
+	filesystem::create_directories(parent, error);
+	_path = parent.string() + separator + "." + _output.filename().string() + ".proyekgen-stage-" +
+		to_string(steady_clock::now().time_since_epoch().count());
+
+	if (!filesystem::create_directory(_path, error)) {
+		_path.clear();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Commit the staged project to the output.
+ *
+ * The staging directory is flushed according to the durability policy, then renamed
+ * to the output (or exchanged with the empty output directory).
+*/
+bool ProjectStage::commit()
+{
+	error_code error;
+
+	if (_path.empty()) {
+		return false;
+	}
+
+	sync(_path, _durability);
+
+#if defined(__linux__)
+	if (filesystem::exists(_output) &&
+		renameat2(AT_FDCWD, _path.string().c_str(), AT_FDCWD, _output.string().c_str(), RENAME_EXCHANGE) == 0) {
+		// The staging path now holds the empty output directory
+		filesystem::remove(_path, error);
+		_path.clear();
+	}
+#endif
+	if (!_path.empty()) {
+		filesystem::remove(_output, error);
+		filesystem::rename(_path, _output, error);
+
+		if (error) {
+			fmt::print("Cannot commit generated project to {0:s}: {1:s}\n", _output, error.message());
+			abort();
+			return false;
+		}
+
+		_path.clear();
+	}
+#if defined(__linux__)
+	if (_durability != ProjectDurability::none) {
+		// Flush the rename itself
+		int fd = open(_output.parent_path().string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd >= 0) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+#endif
+
+	return true;
+}
+
+/*
+ * Remove the staging directory without committing.
+*/
+void ProjectStage::abort()
+{
+	error_code error;
+
+	if (!_path.empty()) {
+		filesystem::remove_all(_path, error);
+		_path.clear();
+	}
+}
+
+/*
+ * Parse the name of a durability policy.
+ *
+ * Returns false if the name is unknown.
+*/
+bool ProjectStage::parse_durability(const string &name, ProjectDurability &durability)
+{
+	if (name == "none") {
+		durability = ProjectDurability::none;
+	} else if (name == "syncfs") {
+		durability = ProjectDurability::syncfs;
+	} else if (name == "fsync") {
+		durability = ProjectDurability::fsync;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Flush a generated project to disk according to a durability policy.
+ *
+ * This function does nothing if the current OS has no implementation.
+*/
+void ProjectStage::sync(const file_path &path, ProjectDurability durability)
+{
+#if defined(__linux__)
+	error_code error;
+	int fd;
+
+	if (durability == ProjectDurability::fsync) {
+		for (const dir_entry &entry : filesystem::recursive_directory_iterator{ path, error }) {
+			if (entry.is_symlink() || (!entry.is_regular_file() && !entry.is_directory())) {
+				continue;
+			}
+
+			fd = open(entry.path().string().c_str(), O_RDONLY | O_CLOEXEC);
+
+			if (fd >= 0) {
+				fsync(fd);
+				close(fd);
+			}
+		}
+	}
+	if (durability != ProjectDurability::none) {
+		// A single syncfs flushes everything that wasn't flushed yet, including the directories
+		fd = open(path.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd >= 0) {
+			(durability == ProjectDurability::syncfs) ? syncfs(fd) : fsync(fd);
+			close(fd);
+		}
+	}
+#endif
+}
@@ -0,0 +1,59 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "system.h"
+
+/*
+ * How generated files are flushed to disk.
+ *
+ * "syncfs" flushes the filesystem once when the project is committed,
+ * "fsync" flushes every file individually.
+*/
+enum class ProjectDurability
+{
+	none,
+	syncfs,
+	fsync
+};
+
+/*
+ * A class that stages a generated project before committing it.
+ *
+ * The project is generated into a hidden sibling directory of the output, then committed
+ * with a single rename, so the output never contains a partially generated project.
+*/
+class ProjectStage
+{
+public:
+	ProjectStage(const file_path &output, ProjectDurability durability = ProjectDurability::none);
+
+	file_path path();
+	bool begin();
+	bool commit();
+	void abort();
+
+	static bool parse_durability(const string &name, ProjectDurability &durability);
+	static void sync(const file_path &path, ProjectDurability durability);
+
+private:
+	file_path _output;
+	file_path _path;
+	ProjectDurability _durability;
+};
@@ -0,0 +1,612 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "store.h"
+
+const string TemplateStore::manifest_name = "project.manifest.json";
+
+TemplateStore::TemplateStore(const file_path &path)
+	: _path(path)
+{}
+
+TemplateStore::TemplateStore()
+{}
+
+/*
+ * Returns the root path of the store.
+*/
+file_path TemplateStore::path()
+{
+	return _path;
+}
+
+/*
+ * Returns the path of a blob using its digest.
+ *
+ * Blobs are sharded by the first two characters of the digest.
+*/
+file_path TemplateStore::blob_path(const string &hash)
+{
+	return _path.string() + separator + "blobs" + separator +
+		hash.substr(0, 2) + separator + hash.substr(2);
+}
+
+/*
+ * Import a template directory into the store.
+ *
+ * The file blobs of the template's project.tar.xz are stored once in the store,
+ * and the destination receives a manifest along with the template's info.json and runners.
+*/
+bool TemplateStore::import(const file_path &source, const file_path &destination)
+{
+	struct archive *reader;
+	struct archive_entry *entry;
+	file_path archive_path = source.string() + separator + "project.tar.xz";
+	unordered_map<string, string> hashes;
+	unordered_map<string, string> checksums;
+	json entries = json::array();
+	size_t added = 0;
+	size_t files = 0;
+	error_code error;
+	int result;
+
+	if (!filesystem::is_regular_file(archive_path)) {
+		fmt::print("Cannot find template data: {0:s}\n", archive_path);
+		return false;
+	}
+
+	filesystem::create_directories(_path.string() + separator + "tmp", error);
+	filesystem::create_directories(destination, error);
+
+	if (error) {
+		fmt::print("Cannot create directory {0:s}: {1:s}\n", destination, error.message());
+		return false;
+	}
+
+	reader = archive_read_new();
+	archive_read_support_format_tar(reader);
+	archive_read_support_filter_xz(reader);
+	archive_read_support_filter_zstd(reader);
+	result = archive_read_open_filename(reader, archive_path.string().c_str(), 10240);
+
+	if (result != ARCHIVE_OK) {
+		fmt::print("Failed to read template data: {0:s}\n", archive_path);
+		archive_read_free(reader);
+		return false;
+	}
+	for (;;) {
+		result = archive_read_next_header(reader, &entry);
+
+		if (result == ARCHIVE_EOF) {
+			break;
+		}
+		if (result < ARCHIVE_WARN) {
+			fmt::print("{0:s}\n", archive_error_string(reader));
+			archive_read_free(reader);
+			return false;
+		}
+
+		json item = json::object();
+		string pathname = archive_entry_pathname(entry);
+
+		if (!SystemPaths::is_contained(file_path(pathname).lexically_normal())) {
+			fmt::print("Skipping entry outside the project: {0:s}\n", pathname);
+			continue;
+		}
+
+		item["path"] = pathname;
+		item["mode"] = archive_entry_perm(entry);
+		item["mtime"] = archive_entry_mtime(entry);
+
+		if (archive_entry_hardlink(entry) != nullptr && hashes.count(archive_entry_hardlink(entry))) {
+			// Hardlinks point to a file that was already stored
+			item["type"] = "file";
+			item["hash"] = hashes[archive_entry_hardlink(entry)];
+			item["xxh3"] = checksums[archive_entry_hardlink(entry)];
+		} else if (archive_entry_filetype(entry) == AE_IFDIR) {
+			item["type"] = "directory";
+		} else if (archive_entry_filetype(entry) == AE_IFLNK) {
+			item["type"] = "symlink";
+			item["target"] = archive_entry_symlink(entry);
+		} else if (archive_entry_filetype(entry) == AE_IFREG) {
+			string checksum;
+			string hash = store_blob(reader, archive_entry_size(entry), added, checksum);
+
+			if (hash.empty()) {
+				fmt::print("Cannot store file: {0:s}\n", pathname);
+				archive_read_free(reader);
+				return false;
+			}
+
+			item["type"] = "file";
+			item["hash"] = hash;
+			item["xxh3"] = checksum;
+			hashes[pathname] = hash;
+			checksums[pathname] = checksum;
+			files++;
+		} else {
+			fmt::print("Skipping unsupported entry: {0:s}\n", pathname);
+			continue;
+		}
+
+		entries.push_back(item);
+	}
+
+	archive_read_free(reader);
+
+	// Write the manifest that replaces the template's project data
+	json manifest = {{"version", 1}, {"store", _path.string()}, {"entries", entries}};
+	file_output manifest_stream(destination.string() + separator + manifest_name);
+	manifest_stream << manifest.dump(1, '\t');
+	manifest_stream.close();
+
+	// Copy everything else from the template (info.json, runners, ...)
+	for (const dir_entry &e : filesystem::directory_iterator{ source }) {
+		string filename = e.path().filename().string();
+
+		if (filename == "project.tar.xz" || filename == manifest_name) {
+			continue;
+		}
+
+		filesystem::copy(e.path(), destination.string() + separator + filename,
+			filesystem::copy_options::recursive | filesystem::copy_options::overwrite_existing, error);
+
+		if (error) {
+			fmt::print("Cannot copy {0:s}: {1:s}\n", e.path(), error.message());
+			return false;
+		}
+	}
+
+	fmt::print("Imported {0:d} files into the store ({1:d} new, {2:d} deduplicated)\n",
+		files, added, files - added);
+	return true;
+}
+
+/*
+ * Materialize a template from its store manifest into the specified destination.
+ *
+ * Identical blobs are reflinked (or hardlinked) if requested and supported,
+ * otherwise they are copied. Written files are recorded into the project manifest,
+ * in update mode files are only written if they are new or unmodified by the user.
+ * Blobs are named by their SHA-256 digest, the manifest also lists their XXH3 digest for the project manifest
+ * and for checking XXH3 digests (blobs are only read for it if the manifest predates it).
+ * File metadata is restored according to the metadata policy, hardlinked files keep the read-only
+ * mode of their blob (executables are linked to an executable copy of it).
+ * Symlinks have to point inside the project, and nothing is written through them.
+*/
+bool TemplateStore::materialize(const file_path &manifest, const file_path &dest, TemplateStoreLink link,
+	TemplateMetadataPolicy metadata, ProjectManifest &project_manifest, bool update, TemplateFilter &filter, const TemplateDigests &digests)
+{
+	file_input manifest_stream(manifest);
+	vector<pair<file_path, int>> directories;
+	unordered_set<string> links;
+	json manifest_json;
+	error_code error;
+
+	try {
+		manifest_json = json::parse(manifest_stream);
+	} catch (json::exception &ex) {
+		fmt::print("Cannot read template manifest {0:s}: {1:s}\n", manifest, ex.what());
+		return false;
+	}
+
+	TemplateStore store = TemplateStore(manifest_json.value("store", string()));
+
+	for (const json &item : manifest_json["entries"]) {
+		string type = item.value("type", string());
+		string pathname = item.value("path", string());
+		string hash = item.value("hash", string());
+		string checksum = item.value("xxh3", string());
+		file_path target = dest.string() + separator + pathname;
+		int mode = item.value("mode", 0644);
+
+		if (!valid_entry(pathname, type, hash)) {
+			return false;
+		}
+		if (SystemPaths::is_linked(pathname, links)) {
+			fmt::print("Refusing to write through a symlink: {0:s}\n", pathname);
+			return false;
+		}
+		if (type == "symlink" && !SystemPaths::is_contained_link(pathname, item.value("target", string()))) {
+			fmt::print("Refusing symlink pointing outside the project: {0:s}\n", pathname);
+			return false;
+		}
+		if (!filter.claim(pathname)) {
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping excluded file: {0:s}\n", pathname);
+			}
+
+			continue;
+		}
+		if (type == "directory") {
+			if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+				fmt::print("Writing file: {0:s}\n", pathname);
+			}
+
+			filesystem::create_directories(target, error);
+
+			if (metadata != TemplateMetadataPolicy::minimal) {
+				directories.push_back({target, mode});
+			}
+
+			continue;
+		}
+
+		if (type == "file" && checksum.empty()) {
+			checksum = HashXxh3::file(store.blob_path(hash));
+		}
+
+		ProjectManifestStatus status = (update && type == "file") ?
+			project_manifest.compare(pathname, checksum) : ProjectManifestStatus::created;
+
+		switch (status) {
+		case ProjectManifestStatus::unchanged:
+			project_manifest.record(pathname, checksum);
+			continue;
+		case ProjectManifestStatus::modified:
+			fmt::print("Keeping modified file: {0:s}\n", pathname);
+			continue;
+		case ProjectManifestStatus::conflict:
+			fmt::print("Conflict: {0:s} was modified locally, keeping local changes\n", pathname);
+			continue;
+		case ProjectManifestStatus::updated:
+			if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+				fmt::print("Updating file: {0:s}\n", pathname);
+			}
+			break;
+		case ProjectManifestStatus::created:
+			if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+				fmt::print("Writing file: {0:s}\n", pathname);
+			}
+			break;
+		}
+
+		filesystem::create_directories(target.parent_path(), error);
+		filesystem::remove(target, error);
+
+		if (type == "symlink") {
+			filesystem::create_symlink(item.value("target", string()), target, error);
+
+			if (error) {
+				fmt::print("Cannot create symlink {0:s}: {1:s}\n", pathname, error.message());
+				return false;
+			}
+
+			links.insert(file_path(pathname).lexically_normal().generic_string());
+			continue;
+		}
+
+		file_path blob = store.blob_path(hash);
+		TemplateStoreLink file_link = link;
+
+		if (!filesystem::is_regular_file(blob)) {
+			fmt::print("Missing blob in template store for file: {0:s}\n", pathname);
+			return false;
+		}
+		if (!digests.check(pathname, digests.checksum() ? checksum : hash)) {
+			return false;
+		}
+		if (file_link == TemplateStoreLink::hardlink && (mode & 0111) != 0) {
+			// Hardlinked files share the mode of their blob
+			file_path executable = executable_blob(blob);
+
+			if (executable.empty()) {
+				file_link = TemplateStoreLink::copy;
+			} else {
+				blob = executable;
+			}
+		}
+		if (!link_blob(blob, target, file_link)) {
+			return false;
+		}
+		if (file_link != TemplateStoreLink::hardlink && metadata == TemplateMetadataPolicy::minimal) {
+			// Copies keep the read-only mode of the blob, so the mode is restored regardless of the policy
+			filesystem::permissions(target, static_cast<filesystem::perms>(mode & 0777), error);
+		} else if (file_link != TemplateStoreLink::hardlink) {
+			// Hardlinked files share the metadata of the blob
+			TemplateMetadata::apply(target, mode, item.value("mtime", static_cast<time_t>(0)), metadata);
+		}
+
+		project_manifest.record(pathname, checksum);
+	}
+
+	// Directory permissions are applied last so read-only directories can still be filled
+	for (const pair<file_path, int> &directory : directories) {
+		filesystem::permissions(directory.first, static_cast<filesystem::perms>(directory.second & 07777), error);
+	}
+
+	return true;
+}
+
+/*
+ * Stream a template from its store manifest into an archive.
+ *
+ * File data is read from the blobs, symlinks are checked like when materializing the template.
+*/
+bool TemplateStore::stream(const file_path &manifest, ProjectStream &stream, TemplateFilter &filter,
+	const TemplateDigests &digests)
+{
+	file_input manifest_stream(manifest);
+	unordered_set<string> links;
+	json manifest_json;
+	error_code error;
+
+	try {
+		manifest_json = json::parse(manifest_stream);
+	} catch (json::exception &ex) {
+		fmt::print("Cannot read template manifest {0:s}: {1:s}\n", manifest, ex.what());
+		return false;
+	}
+
+	TemplateStore store = TemplateStore(manifest_json.value("store", string()));
+
+	for (const json &item : manifest_json["entries"]) {
+		string type = item.value("type", string());
+		string pathname = item.value("path", string());
+		string hash = item.value("hash", string());
+		string checksum = item.value("xxh3", string());
+		uint32_t mode = item.value("mode", 0644);
+		int64_t mtime = item.value("mtime", static_cast<int64_t>(0));
+		struct archive_entry *entry;
+		bool added;
+
+		if (!valid_entry(pathname, type, hash)) {
+			return false;
+		}
+		if (SystemPaths::is_linked(pathname, links)) {
+			fmt::print("Refusing to write through a symlink: {0:s}\n", pathname);
+			return false;
+		}
+		if (type == "symlink" && !SystemPaths::is_contained_link(pathname, item.value("target", string()))) {
+			fmt::print("Refusing symlink pointing outside the project: {0:s}\n", pathname);
+			return false;
+		}
+		if (!filter.claim(pathname)) {
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping excluded file: {0:s}\n", pathname);
+			}
+
+			continue;
+		}
+		if (type == "directory") {
+			entry = ProjectStream::entry(pathname, AE_IFDIR | mode, mtime, 0);
+			added = stream.add_entry(entry);
+		} else if (type == "symlink") {
+			entry = ProjectStream::entry(pathname, AE_IFLNK | mode, mtime, 0, item.value("target", string()));
+			added = stream.add_entry(entry);
+			links.insert(file_path(pathname).lexically_normal().generic_string());
+		} else {
+			file_path blob = store.blob_path(hash);
+			uintmax_t size = filesystem::file_size(blob, error);
+
+			if (error) {
+				fmt::print("Missing blob in template store for file: {0:s}\n", pathname);
+				return false;
+			}
+			if (digests.checksum() && checksum.empty()) {
+				checksum = HashXxh3::file(blob);
+			}
+			if (!digests.check(pathname, digests.checksum() ? checksum : hash)) {
+				return false;
+			}
+
+			entry = ProjectStream::entry(pathname, AE_IFREG | mode, mtime, size);
+			added = stream.add_file(entry, blob);
+		}
+
+		archive_entry_free(entry);
+
+		if (!added) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the import function
+ *
+ * Streams the current entry's data into a temporary file while hashing it,
+ * the file is then renamed into place unless the blob already exists.
+ * Returns the SHA-256 digest naming the blob, its XXH3 digest is returned in checksum.
+*/
+string TemplateStore::store_blob(struct archive *reader, la_int64_t size, size_t &added, string &checksum)
+{
+	static size_t counter = 0;
+	file_path temp_path = _path.string() + separator + "tmp" + separator +
+		"blob-" + to_string(steady_clock::now().time_since_epoch().count()) + "-" + to_string(counter++);
+	file_output stream(temp_path, std::ios::binary | std::ios::trunc);
+	HashDigest hash(true, true);
+	const void *buffer;
+	la_int64_t offset;
+	la_int64_t position = 0;
+	size_t block_size;
+	error_code error;
+	int result;
+
+	if (!stream.is_open()) {
+		return string();
+	}
+	for (;;) {
+		result = archive_read_data_block(reader, &buffer, &block_size, &offset);
+
+		if (result == ARCHIVE_EOF) {
+			break;
+		}
+		if (result < ARCHIVE_OK) {
+			stream.close();
+			filesystem::remove(temp_path, error);
+			return string();
+		}
+		if (!fill(stream, hash, position, offset)) {
+			filesystem::remove(temp_path, error);
+			return string();
+		}
+
+		stream.write(static_cast<const char*>(buffer), block_size);
+		hash.update(buffer, block_size);
+		position = offset + block_size;
+	}
+
+	if (!fill(stream, hash, position, size)) {
+		// Holes at the end of sparse entries have no data blocks
+		filesystem::remove(temp_path, error);
+		return string();
+	}
+
+	stream.close();
+	string digest = hash.sha256();
+	file_path blob = blob_path(digest);
+	checksum = hash.xxh3();
+
+	if (filesystem::exists(blob)) {
+		filesystem::remove(temp_path, error);
+		return digest;
+	}
+
+	filesystem::create_directories(blob.parent_path(), error);
+	filesystem::rename(temp_path, blob, error);
+
+	if (error) {
+		filesystem::remove(temp_path, error);
+		return filesystem::exists(blob) ? digest : string();
+	}
+
+	filesystem::permissions(blob, filesystem::perms::owner_read | filesystem::perms::group_read |
+		filesystem::perms::others_read, error);
+	added++;
+	return digest;
+}
+
+/*
+ * Internally used by the store_blob function
+ *
+ * Writes and hashes zeros from the current position up to the end of a hole.
+*/
+bool TemplateStore::fill(file_output &stream, HashDigest &hash, la_int64_t &position, la_int64_t end)
+{
+	static const char zeros[65536] = {};
+
+	while (position < end) {
+		size_t length = static_cast<size_t>(std::min<la_int64_t>(end - position, sizeof(zeros)));
+		stream.write(zeros, static_cast<std::streamsize>(length));
+		hash.update(zeros, length);
+		position += static_cast<la_int64_t>(length);
+	}
+
+	return static_cast<bool>(stream);
+}
+
+/*
+ * Internally used by the materialize and stream functions
+ *
+ * Returns false if a manifest entry would be written outside the destination,
+ * or if its hash isn't a SHA-256 digest (blobs are located by their hashes).
+*/
+bool TemplateStore::valid_entry(const string &pathname, const string &type, const string &hash)
+{
+	if (!SystemPaths::is_contained(file_path(pathname).lexically_normal())) {
+		fmt::print("Refusing to write outside the project: {0:s}\n", pathname);
+		return false;
+	}
+	if (type == "file" && (hash.size() != 64 || hash.find_first_not_of("0123456789abcdef") != string::npos)) {
+		fmt::print("Invalid blob hash in template manifest for file: {0:s}\n", pathname);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the materialize function
+ *
+ * The link is set to copy if the blob had to be copied instead.
+*/
+bool TemplateStore::link_blob(const file_path &blob, const file_path &dest, TemplateStoreLink &link)
+{
+	error_code error;
+
+#if defined(__linux__)
+	if (link == TemplateStoreLink::hardlink && ::link(blob.string().c_str(), dest.string().c_str()) == 0) {
+		return true;
+	}
+	if (link == TemplateStoreLink::reflink) {
+		int source_fd = open(blob.string().c_str(), O_RDONLY);
+		int dest_fd = open(dest.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int result = (source_fd >= 0 && dest_fd >= 0) ? ioctl(dest_fd, FICLONE, source_fd) : -1;
+
+		if (source_fd >= 0) {
+			close(source_fd);
+		}
+		if (dest_fd >= 0) {
+			close(dest_fd);
+		}
+		if (result == 0) {
+			return true;
+		}
+
+		// Reflinks are unsupported here (or across filesystems), fall back to a copy
+		filesystem::remove(dest, error);
+	}
+#endif
+
+	link = TemplateStoreLink::copy;
+	filesystem::copy_file(blob, dest, filesystem::copy_options::overwrite_existing, error);
+
+	if (error) {
+		fmt::print("Cannot copy blob to {0:s}: {1:s}\n", dest, error.message());
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the materialize function
+ *
+ * Returns the executable copy of a blob, it's created next to the blob when first used.
+ * An empty path is returned if it cannot be created.
+*/
+file_path TemplateStore::executable_blob(const file_path &blob)
+{
+	file_path executable = blob.string() + "-x";
+	file_path temp_path = executable.string() + ".tmp-" + to_string(steady_clock::now().time_since_epoch().count());
+	error_code error;
+
+	if (filesystem::is_regular_file(executable, error)) {
+		return executable;
+	}
+
+	filesystem::copy_file(blob, temp_path, error);
+
+	if (!error) {
+		filesystem::permissions(temp_path, filesystem::perms::owner_read | filesystem::perms::owner_exec |
+			filesystem::perms::group_read | filesystem::perms::group_exec | filesystem::perms::others_read |
+			filesystem::perms::others_exec, error);
+	}
+	if (!error) {
+		filesystem::rename(temp_path, executable, error);
+	}
+	if (error) {
+		filesystem::remove(temp_path, error);
+		return file_path();
+	}
+
+	return executable;
+}
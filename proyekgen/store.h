@@ -0,0 +1,76 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "digest.h"
+#include "filter.h"
+#include "hash.h"
+#include "manifest.h"
+#include "metadata.h"
+#include "stream.h"
+#include "system.h"
+
+/*
+ * How files are materialized from the template store.
+ *
+ * Reflinks fall back to copies on filesystems without support.
+ * Hardlinks share the store's inode, so they should only be used
+ * for generated projects that are never edited in place.
+*/
+enum class TemplateStoreLink
+{
+	copy,
+	reflink,
+	hardlink
+};
+
+/*
+ * A content-addressed store of template files.
+ *
+ * Every file blob is stored once by its SHA-256 digest, templates imported
+ * into the store keep a per-template manifest (project.manifest.json) instead
+ * of their own project archive.
+*/
+class TemplateStore
+{
+public:
+	TemplateStore(const file_path &path);
+	TemplateStore();
+
+	file_path path();
+	file_path blob_path(const string &hash);
+	bool import(const file_path &source, const file_path &destination);
+	static bool materialize(const file_path &manifest, const file_path &dest, TemplateStoreLink link,
+		TemplateMetadataPolicy metadata, ProjectManifest &project_manifest, bool update, TemplateFilter &filter,
+		const TemplateDigests &digests);
+	static bool stream(const file_path &manifest, ProjectStream &stream, TemplateFilter &filter,
+		const TemplateDigests &digests);
+
+	static const string manifest_name;
+
+private:
+	string store_blob(struct archive *reader, la_int64_t size, size_t &added, string &checksum);
+	static bool fill(file_output &stream, HashDigest &hash, la_int64_t &position, la_int64_t end);
+	static bool valid_entry(const string &pathname, const string &type, const string &hash);
+	static bool link_blob(const file_path &blob, const file_path &dest, TemplateStoreLink &link);
+	static file_path executable_blob(const file_path &blob);
+
+	file_path _path = (SystemRuntime::is_root() ? SystemBasePaths::global_data_path() :
+		SystemBasePaths::local_data_path()).string() + separator + "store";
+};
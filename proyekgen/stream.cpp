@@ -0,0 +1,450 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "stream.h"
+
+mutex ProjectStream::_temp_mutex;
+unordered_set<string> ProjectStream::_temp_paths;
+
+ProjectStream::ProjectStream(const file_path &path, ProjectStreamFormat format)
+	: _path(path), _format(format)
+{}
+
+ProjectStream::~ProjectStream()
+{
+	abort();
+}
+
+/*
+ * Returns the path of the archive, "-" if it's streamed to stdout.
+*/
+file_path ProjectStream::path()
+{
+	return _path;
+}
+
+/*
+ * Open the archive for writing.
+ *
+ * If streamed to stdout, the archive takes over the stdout descriptor
+ * and everything printed afterwards goes to stderr instead.
+*/
+bool ProjectStream::open()
+{
+	int result;
+
+	_writer = archive_write_new();
+	archive_write_set_format_pax_restricted(_writer);
+
+	if (_format == ProjectStreamFormat::tar_zst) {
+		archive_write_add_filter_zstd(_writer);
+	}
+	if (_path == "-") {
+		fflush(stdout);
+#if defined(_WIN32)
+		_fd = _dup(_fileno(stdout));
+		_dup2(_fileno(stderr), _fileno(stdout));
+#else
+		_fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+
+		if (_fd < 0) {
+			fmt::print("Cannot write {0:s}: Cannot duplicate stdout\n", _path);
+			abort();
+			return false;
+		}
+
+		result = archive_write_open_fd(_writer, _fd);
+	} else {
+		static std::once_flag registered;
+		std::call_once(registered, []() {
+			std::atexit(remove_temp_paths);
+		});
+
+		_temp_path = _path.string() + ".tmp-" + to_string(steady_clock::now().time_since_epoch().count());
+
+		{
+			lock_guard lock(_temp_mutex);
+			_temp_paths.insert(_temp_path.string());
+		}
+
+		result = archive_write_open_filename(_writer, _temp_path.string().c_str());
+	}
+	if (result != ARCHIVE_OK) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", _path, archive_error_string(_writer));
+		abort();
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Add an entry without data, like a directory or a symlink.
+ *
+ * The data of regular files added this way is appended with add_block.
+*/
+bool ProjectStream::add_entry(struct archive_entry *entry)
+{
+	return header(entry);
+}
+
+/*
+ * Add an entry of a template archive, its data is copied from the reader.
+ *
+ * Holes of sparse entries are written as zeros. The data is hashed
+ * while it's copied, unless no hash is passed.
+*/
+bool ProjectStream::add_reader(struct archive_entry *entry, struct archive *reader, HashDigest *hash)
+{
+	static const char zeros[4096] = {};
+	const void *buffer;
+	la_int64_t offset;
+	la_int64_t position = 0;
+	la_int64_t size = archive_entry_size(entry);
+	size_t block_size;
+	int result;
+
+	if (!header(entry)) {
+		return false;
+	}
+	if (archive_entry_filetype(entry) != AE_IFREG || archive_entry_hardlink(entry) != nullptr) {
+		return true;
+	}
+	for (;;) {
+		result = archive_read_data_block(reader, &buffer, &block_size, &offset);
+
+		if (result == ARCHIVE_EOF) {
+			break;
+		}
+		if (result < ARCHIVE_OK) {
+			fmt::print("{0:s}\n", archive_error_string(reader));
+			return false;
+		}
+		for (; position < offset; position += sizeof(zeros)) {
+			size_t length = static_cast<size_t>(std::min<la_int64_t>(offset - position, sizeof(zeros)));
+
+			if (!data(zeros, length)) {
+				return false;
+			}
+
+			if (hash != nullptr) {
+				hash->update(zeros, length);
+			}
+		}
+		if (!data(buffer, block_size)) {
+			return false;
+		}
+
+		if (hash != nullptr) {
+			hash->update(buffer, block_size);
+		}
+		position = offset + block_size;
+	}
+	for (; position < size; position += sizeof(zeros)) {
+		size_t length = static_cast<size_t>(std::min<la_int64_t>(size - position, sizeof(zeros)));
+
+		if (!data(zeros, length)) {
+			return false;
+		}
+
+		if (hash != nullptr) {
+			hash->update(zeros, length);
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Add an entry with its data in memory, the size of the data is the size of the entry.
+*/
+bool ProjectStream::add_data(struct archive_entry *entry, const char *buffer)
+{
+	size_t size = static_cast<size_t>(std::max<la_int64_t>(archive_entry_size(entry), 0));
+	return header(entry) && data(buffer, size);
+}
+
+/*
+ * Append a block of data to the regular file added last by add_entry.
+ *
+ * The blocks must add up to the size of the entry.
+*/
+bool ProjectStream::add_block(const void *buffer, size_t size)
+{
+	return data(buffer, size);
+}
+
+/*
+ * Add an entry with its data read from a file.
+*/
+bool ProjectStream::add_file(struct archive_entry *entry, const file_path &source)
+{
+	file_input stream(source, std::ios::binary);
+	vector<char> buffer(1 << 16);
+
+	if (!stream.is_open()) {
+		fmt::print("Cannot read file: {0:s}\n", source);
+		return false;
+	}
+	if (!header(entry)) {
+		return false;
+	}
+	while (stream) {
+		stream.read(buffer.data(), buffer.size());
+
+		if (stream.gcount() > 0 && !data(buffer.data(), static_cast<size_t>(stream.gcount()))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Add the contents of a directory, their paths are relative to the directory.
+ *
+ * Files that still have the modification time listed in unchanged are skipped, along with their directories.
+*/
+bool ProjectStream::add_directory(const file_path &source,
+	const unordered_map<string, filesystem::file_time_type> &unchanged)
+{
+	error_code error;
+
+	for (const dir_entry &e : filesystem::recursive_directory_iterator{ source, error }) {
+		string pathname = e.path().lexically_relative(source).generic_string();
+		filesystem::file_status status = e.symlink_status(error);
+		uint32_t mode = static_cast<uint32_t>(status.permissions()) & 07777;
+		auto mtime = std::chrono::duration_cast<std::chrono::seconds>(
+			e.last_write_time(error) - filesystem::file_time_type::clock::now() +
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		struct archive_entry *entry;
+		bool added;
+
+		if (unchanged.count(pathname) && unchanged.at(pathname) == e.last_write_time(error)) {
+			continue;
+		}
+		if (filesystem::is_symlink(status)) {
+			string target = filesystem::read_symlink(e.path(), error).string();
+			entry = ProjectStream::entry(pathname, AE_IFLNK | mode, mtime, 0, target);
+			added = add_entry(entry);
+		} else if (filesystem::is_directory(status)) {
+			// Directories of the input files are already in the archive
+			bool input_directory = std::any_of(unchanged.begin(), unchanged.end(), [&](const auto &input) {
+				return input.first.rfind(pathname + "/", 0) == 0;
+			});
+
+			if (input_directory) {
+				continue;
+			}
+
+			entry = ProjectStream::entry(pathname, AE_IFDIR | mode, mtime, 0);
+			added = add_entry(entry);
+		} else if (filesystem::is_regular_file(status)) {
+			entry = ProjectStream::entry(pathname, AE_IFREG | mode, mtime, e.file_size(error));
+			added = add_file(entry, e.path());
+		} else {
+			continue;
+		}
+
+		archive_entry_free(entry);
+
+		if (!added) {
+			return false;
+		}
+	}
+	if (error) {
+		fmt::print("Cannot read directory {0:s}: {1:s}\n", source, error.message());
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Finish the archive and rename it into place.
+*/
+bool ProjectStream::close()
+{
+	error_code error;
+
+	if (_writer == nullptr) {
+		return false;
+	}
+	if (archive_write_close(_writer) != ARCHIVE_OK) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", _path, archive_error_string(_writer));
+		abort();
+		return false;
+	}
+
+	archive_write_free(_writer);
+	_writer = nullptr;
+
+	if (_fd >= 0) {
+#if defined(_WIN32)
+		_close(_fd);
+#else
+		::close(_fd);
+#endif
+		_fd = -1;
+		return true;
+	}
+
+	filesystem::rename(_temp_path, _path, error);
+
+	if (error) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", _path, error.message());
+	}
+
+	remove_temp();
+	return !error;
+}
+
+/*
+ * Discard the archive, a partially written archive file is removed.
+*/
+void ProjectStream::abort()
+{
+	if (_writer != nullptr) {
+		archive_write_free(_writer);
+		_writer = nullptr;
+	}
+	if (_fd >= 0) {
+#if defined(_WIN32)
+		_close(_fd);
+#else
+		::close(_fd);
+#endif
+	}
+
+	remove_temp();
+	_fd = -1;
+}
+
+/*
+ * Parse the name of an output format, "-" is a tar archive streamed to stdout.
+ *
+ * Returns false if the name is unknown.
+*/
+bool ProjectStream::parse_format(const string &name, ProjectStreamFormat &format)
+{
+	if (name == "directory") {
+		format = ProjectStreamFormat::directory;
+	} else if (name == "tar" || name == "-") {
+		format = ProjectStreamFormat::tar;
+	} else if (name == "tar.zst") {
+		format = ProjectStreamFormat::tar_zst;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Create an archive entry, the mode includes the file type bits.
+ *
+ * The caller frees the entry with archive_entry_free.
+*/
+struct archive_entry *ProjectStream::entry(const string &pathname, uint32_t mode, int64_t mtime, uint64_t size,
+	const string &link)
+{
+	struct archive_entry *entry = archive_entry_new();
+	archive_entry_set_pathname(entry, pathname.c_str());
+	archive_entry_set_mode(entry, static_cast<mode_t>(mode));
+	archive_entry_set_mtime(entry, static_cast<time_t>(mtime), 0);
+
+	if ((mode & AE_IFMT) == AE_IFREG) {
+		archive_entry_set_size(entry, static_cast<la_int64_t>(size));
+	} else if ((mode & AE_IFMT) == AE_IFLNK) {
+		archive_entry_set_symlink(entry, link.c_str());
+	}
+
+	return entry;
+}
+
+/*
+ * Internally used by the add functions
+*/
+bool ProjectStream::header(struct archive_entry *entry)
+{
+	if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+		fmt::print("Writing file: {0:s}\n", archive_entry_pathname(entry));
+	}
+	if (archive_write_header(_writer, entry) < ARCHIVE_WARN) {
+		fmt::print("{0:s}\n", archive_error_string(_writer));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the add functions
+*/
+bool ProjectStream::data(const void *buffer, size_t size)
+{
+	if (archive_write_data(_writer, buffer, size) < 0) {
+		fmt::print("{0:s}\n", archive_error_string(_writer));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the close and abort functions
+ *
+ * Removes the temporary archive if it wasn't renamed into place, it's no longer removed on exit.
+*/
+void ProjectStream::remove_temp()
+{
+	error_code error;
+
+	if (_temp_path.empty()) {
+		return;
+	}
+
+	filesystem::remove(_temp_path, error);
+
+	{
+		lock_guard lock(_temp_mutex);
+		_temp_paths.erase(_temp_path.string());
+	}
+
+	_temp_path.clear();
+}
+
+/*
+ * Internally used by the open function
+ *
+ * Registered with atexit, removes the temporary archives of streams that weren't closed,
+ * like when a runner exits the process while a project is streamed.
+*/
+void ProjectStream::remove_temp_paths()
+{
+	lock_guard lock(_temp_mutex);
+	error_code error;
+
+	for (const string &path : _temp_paths) {
+		filesystem::remove(path, error);
+	}
+
+	_temp_paths.clear();
+}
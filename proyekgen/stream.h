@@ -0,0 +1,82 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "hash.h"
+#include "system.h"
+
+/*
+ * How a generated project is written.
+ *
+ * Projects are written into a directory by default, or streamed
+ * into a tar archive (compressed with zstd if "tar.zst") instead.
+*/
+enum class ProjectStreamFormat
+{
+	directory,
+	tar,
+	tar_zst
+};
+
+/*
+ * A class that streams a generated project into an archive.
+ *
+ * Entries are written as they're read from the template, nothing is written
+ * to the output directory. Archives are written next to their path and renamed
+ * into place when closed, the output "-" streams the archive to stdout.
+ * Partially written archives are removed on exit, even if the process exits early.
+*/
+class ProjectStream
+{
+public:
+	ProjectStream(const file_path &path, ProjectStreamFormat format);
+	~ProjectStream();
+	ProjectStream(const ProjectStream &) = delete;
+	ProjectStream &operator=(const ProjectStream &) = delete;
+
+	file_path path();
+	bool open();
+	bool add_entry(struct archive_entry *entry);
+	bool add_reader(struct archive_entry *entry, struct archive *reader, HashDigest *hash);
+	bool add_data(struct archive_entry *entry, const char *buffer);
+	bool add_block(const void *buffer, size_t size);
+	bool add_file(struct archive_entry *entry, const file_path &source);
+	bool add_directory(const file_path &source, const unordered_map<string, filesystem::file_time_type> &unchanged);
+	bool close();
+	void abort();
+
+	static bool parse_format(const string &name, ProjectStreamFormat &format);
+	static struct archive_entry *entry(const string &pathname, uint32_t mode, int64_t mtime, uint64_t size,
+		const string &link = string());
+
+private:
+	bool header(struct archive_entry *entry);
+	bool data(const void *buffer, size_t size);
+	void remove_temp();
+	static void remove_temp_paths();
+
+	static mutex _temp_mutex;
+	static unordered_set<string> _temp_paths;
+
+	file_path _path;
+	file_path _temp_path;
+	ProjectStreamFormat _format;
+	struct archive *_writer = nullptr;
+	int _fd = -1;
+};
@@ -0,0 +1,512 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "sync.h"
+
+const string TemplateSync::index_name = "chunks.json";
+
+// Chunks are cut where the rolling hash matches the mask, so they're 64 KiB on average
+static const uint64_t chunk_mask = (1 << 16) - 1;
+static const size_t chunk_min_size = 16 * 1024;
+static const size_t chunk_max_size = 256 * 1024;
+
+/*
+ * Returns the table of the rolling (gear) hash, generated with SplitMix64.
+*/
+static const uint64_t *gear_table()
+{
+	static uint64_t table[256];
+	static std::once_flag initialized;
+
+	std::call_once(initialized, []() {
+		uint64_t state = 0;
+
+		for (uint64_t &value : table) {
+			uint64_t z = (state += 0x9e3779b97f4a7c15);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			value = z ^ (z >> 31);
+		}
+	});
+
+	return table;
+}
+
+TemplateSync::TemplateSync(const file_path &source)
+	: _source(source.lexically_normal())
+{
+	if (_source.filename().empty()) {
+		// Drop the trailing separator of the source directory
+		_source = _source.parent_path();
+	}
+}
+
+/*
+ * Returns the template directory on the mirror.
+*/
+file_path TemplateSync::source()
+{
+	return _source;
+}
+
+/*
+ * Install (or update) the template into the specified destination.
+ *
+ * If update is true, the template has to be installed already. Files of the staged
+ * template are assembled from the chunks of the installed template whenever they match,
+ * chunks read from the mirror are checked against their hashes. The mirror's index is trusted
+ * for files of the indexed size, a file that doesn't match its content hash once assembled
+ * is read from the mirror in full and chunked again.
+*/
+bool TemplateSync::install(const file_path &destination, bool update)
+{
+	vector<TemplateChunkFile> source_files;
+	vector<TemplateChunkFile> installed_files;
+	unordered_map<string, pair<string, TemplateChunk>> available;
+	unordered_set<string> unreadable;
+	file_input local_stream;
+	string local_path;
+	file_path staging_path;
+	size_t unindexed = 0;
+	size_t installed_unindexed = 0;
+	uintmax_t reused = 0;
+	uintmax_t transferred = 0;
+	size_t chunks = 0;
+	size_t chunks_transferred = 0;
+	vector<char> data;
+	error_code error;
+
+	if (!filesystem::is_directory(_source)) {
+		fmt::print("Cannot find template directory: {0:s}\n", _source);
+		return false;
+	}
+	if (update && !filesystem::is_directory(destination)) {
+		fmt::print("Template is not installed: {0:s}\n", destination);
+		return false;
+	}
+	if (!scan(_source, source_files, unindexed, false)) {
+		return false;
+	}
+	if (unindexed > 0) {
+		fmt::print("Warning: {0:d} of {1:d} files are missing from {2:s} on the mirror (or changed since), "
+			"they're read in full to chunk them\n", unindexed, source_files.size(), index_name);
+	}
+	if (filesystem::is_directory(destination) && scan(destination, installed_files, installed_unindexed, true)) {
+		for (const TemplateChunkFile &file : installed_files) {
+			for (const TemplateChunk &c : file.chunks) {
+				available.emplace(c.hash, pair<string, TemplateChunk>(file.path, c));
+			}
+		}
+	}
+
+	staging_path = destination.parent_path().string() + separator + "." + destination.filename().string() +
+		".proyekgen-sync-" + to_string(steady_clock::now().time_since_epoch().count());
+	filesystem::create_directories(staging_path, error);
+
+	if (error) {
+		fmt::print("Cannot create directory {0:s}: {1:s}\n", staging_path, error.message());
+		return false;
+	}
+
+	// Directories and symlinks aren't chunked, they're recreated as they are
+	for (const dir_entry &e : filesystem::recursive_directory_iterator{ _source, error }) {
+		file_path target = staging_path.string() + separator + e.path().lexically_relative(_source).string();
+
+		if (e.is_symlink()) {
+			filesystem::create_directories(target.parent_path(), error);
+			filesystem::copy_symlink(e.path(), target, error);
+		} else if (e.is_directory()) {
+			filesystem::create_directories(target, error);
+		}
+		if (error) {
+			break;
+		}
+	}
+
+	// Assemble a staged file from its chunks, returns false if a chunk read from the mirror
+	// or the whole file doesn't match its hash. Errors writing the file are broken
+	auto assemble = [&](const TemplateChunkFile &file, bool &broken) {
+		file_path target = staging_path.string() + separator + file.path;
+		file_input source_stream(_source.string() + separator + file.path, std::ios::binary);
+		file_output stream(target, std::ios::binary | std::ios::trunc);
+		HashXxh3 hash;
+		uintmax_t file_reused = 0;
+		uintmax_t file_transferred = 0;
+		size_t file_chunks_transferred = 0;
+
+		if (!source_stream.is_open() || !stream.is_open()) {
+			fmt::print("Cannot copy file: {0:s}\n", file.path);
+			broken = true;
+			return false;
+		}
+		for (const TemplateChunk &c : file.chunks) {
+			auto local = available.find(c.hash);
+
+			if (local != available.end() && !unreadable.count(local->second.first)) {
+				const pair<string, TemplateChunk> &location = local->second;
+
+				// Only one installed file is kept open, files are mostly assembled from a single one
+				if (local_path != location.first) {
+					local_stream.close();
+					local_stream.open(destination.string() + separator + location.first, std::ios::binary);
+					local_path = location.first;
+				}
+				if (!local_stream.is_open()) {
+					fmt::print("Cannot read installed file {0:s}, reading its chunks from the mirror\n",
+						location.first);
+					unreadable.insert(location.first);
+					local_path.clear();
+				} else if (read_chunk(local_stream, location.second, data)) {
+					stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+					hash.update(data.data(), data.size());
+					file_reused += c.size;
+					continue;
+				}
+			}
+			if (!read_chunk(source_stream, c, data)) {
+				return false;
+			}
+
+			stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+			hash.update(data.data(), data.size());
+			file_transferred += c.size;
+			file_chunks_transferred++;
+		}
+
+		stream.close();
+
+		if (!stream) {
+			fmt::print("Cannot write file: {0:s}\n", target);
+			broken = true;
+			return false;
+		}
+		if (hash.finish() != file.hash) {
+			return false;
+		}
+
+		reused += file_reused;
+		transferred += file_transferred;
+		chunks += file.chunks.size();
+		chunks_transferred += file_chunks_transferred;
+		return true;
+	};
+
+	for (size_t i = 0; i < source_files.size() && !error; i++) {
+		TemplateChunkFile &file = source_files[i];
+		file_path source_path = _source.string() + separator + file.path;
+		bool broken = false;
+		bool assembled = assemble(file, broken);
+
+		if (!assembled && !broken) {
+			// The mirror's index is out of date for this file
+			fmt::print("Warning: {0:s} doesn't match {1:s} on the mirror, it's read in full to chunk it\n",
+				file.path, index_name);
+			file.chunks.clear();
+			assembled = chunk(source_path, file.chunks, file.hash) && assemble(file, broken);
+
+			if (!assembled && !broken) {
+				fmt::print("File changed on the mirror while updating: {0:s}\n", file.path);
+			}
+		}
+		if (!assembled) {
+			filesystem::remove_all(staging_path, error);
+			return false;
+		}
+
+		filesystem::permissions(staging_path.string() + separator + file.path,
+			filesystem::status(source_path, error).permissions(), error);
+	}
+	if (error) {
+		fmt::print("Cannot copy template {0:s}: {1:s}\n", _source, error.message());
+		filesystem::remove_all(staging_path, error);
+		return false;
+	}
+
+	local_stream.close();
+
+	// The installed template keeps the chunks of its files, so they're not read again on the next update
+	file_output index_stream(staging_path.string() + separator + index_name);
+	index_stream << index_json(source_files).dump(1, '\t') << "\n";
+	index_stream.close();
+
+	if (!swap(staging_path, destination)) {
+		filesystem::remove_all(staging_path, error);
+		return false;
+	}
+
+	fmt::print("{0:s} template: {1:s}\n", update ? "Updated" : "Installed", destination);
+	fmt::print("Transferred {0:d} of {1:d} chunks ({2:.1f} MiB, {3:.1f} MiB reused)\n", chunks_transferred, chunks,
+		transferred / 1048576.0, reused / 1048576.0);
+	return true;
+}
+
+/*
+ * Write the chunk index of a template directory, used when it's installed from a mirror.
+*/
+bool TemplateSync::write_index(const file_path &directory)
+{
+	vector<TemplateChunkFile> files;
+	file_path index_path = directory.string() + separator + index_name;
+	file_path temp_path = index_path.string() + ".tmp";
+	size_t unindexed = 0;
+	error_code error;
+
+	if (!scan(directory, files, unindexed, true)) {
+		return false;
+	}
+
+	file_output stream(temp_path);
+	stream << index_json(files).dump(1, '\t') << "\n";
+	stream.close();
+
+	if (!stream) {
+		fmt::print("Cannot write {0:s}\n", index_path);
+		filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	filesystem::rename(temp_path, index_path, error);
+
+	if (error) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", index_path, error.message());
+		filesystem::remove(temp_path, error);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the install and write_index functions
+ *
+ * Lists the regular files of a template directory with their chunks. The chunks are taken
+ * from the directory's index if the content hash of a file still matches, otherwise the file
+ * is read and chunked, and counted in unindexed. Without verify (on the mirror) files aren't read
+ * to hash them, the index is trusted if the size matches and the install function checks
+ * the content hash once the file is assembled.
+*/
+bool TemplateSync::scan(const file_path &directory, vector<TemplateChunkFile> &files, size_t &unindexed,
+	bool verify)
+{
+	file_input index_stream(directory.string() + separator + index_name);
+	json index_json = json::object();
+	error_code error;
+
+	if (index_stream.is_open()) {
+		index_json = json::parse(index_stream, nullptr, false);
+	}
+	if (index_json.is_discarded() || index_json.value("version", 0) != 2 ||
+		index_json.value("chunk_size", static_cast<uint64_t>(0)) != chunk_mask + 1) {
+		index_json = json::object();
+	}
+
+	const json &indexed_files = index_json.contains("files") ? index_json["files"] : json::object();
+
+	for (const dir_entry &e : filesystem::recursive_directory_iterator{ directory, error }) {
+		if (!e.is_regular_file() || e.is_symlink()) {
+			continue;
+		}
+
+		TemplateChunkFile file;
+		file.path = e.path().lexically_relative(directory).generic_string();
+
+		if (file.path == index_name || file.path == index_name + ".tmp") {
+			continue;
+		}
+
+		file.size = e.file_size(error);
+		const json &indexed = indexed_files.contains(file.path) ? indexed_files[file.path] : json::object();
+		string indexed_hash = indexed.value("xxh3", string());
+
+		if (!indexed_hash.empty() && indexed.value("size", static_cast<uintmax_t>(0)) == file.size &&
+			(!verify || HashXxh3::file(e.path()) == indexed_hash)) {
+			uint64_t offset = 0;
+
+			file.hash = indexed_hash;
+
+			for (const json &c : indexed.value("chunks", json::array())) {
+				TemplateChunk indexed;
+				indexed.offset = offset;
+				indexed.size = c.at(0).get<uint64_t>();
+				indexed.hash = c.at(1).get<string>();
+				offset += indexed.size;
+				file.chunks.push_back(indexed);
+			}
+		} else if (chunk(e.path(), file.chunks, file.hash)) {
+			unindexed++;
+		} else {
+			fmt::print("Cannot read file: {0:s}\n", e.path());
+			return false;
+		}
+
+		files.push_back(file);
+	}
+	if (error) {
+		fmt::print("Cannot read directory {0:s}: {1:s}\n", directory, error.message());
+		return false;
+	}
+
+	std::sort(files.begin(), files.end(), [](const TemplateChunkFile &a, const TemplateChunkFile &b) {
+		return a.path < b.path;
+	});
+	return true;
+}
+
+/*
+ * Internally used by the scan function
+ *
+ * Splits a file into chunks where the rolling hash of the last bytes matches the chunk mask,
+ * chunks are kept between the minimum and maximum chunk size. The file's content hash
+ * is computed along the way.
+*/
+bool TemplateSync::chunk(const file_path &path, vector<TemplateChunk> &chunks, string &hash)
+{
+	HashXxh3 content;
+	const uint64_t *gear = gear_table();
+	file_input stream(path, std::ios::binary);
+	vector<char> buffer(1 << 20);
+	vector<char> data;
+	uint64_t rolling = 0;
+	uint64_t offset = 0;
+
+	if (!stream.is_open()) {
+		return false;
+	}
+
+	auto cut = [&]() {
+		TemplateChunk c;
+		c.offset = offset;
+		c.size = data.size();
+		c.hash = fmt::format("{0:016x}", XXH3_64bits(data.data(), data.size()));
+		chunks.push_back(c);
+		offset += data.size();
+		data.clear();
+		rolling = 0;
+	};
+
+	data.reserve(chunk_max_size);
+
+	while (stream) {
+		stream.read(buffer.data(), buffer.size());
+		content.update(buffer.data(), static_cast<size_t>(stream.gcount()));
+
+		for (std::streamsize i = 0; i < stream.gcount(); i++) {
+			unsigned char byte = static_cast<unsigned char>(buffer[i]);
+			rolling = (rolling << 1) + gear[byte];
+			data.push_back(buffer[i]);
+
+			if ((data.size() >= chunk_min_size && (rolling & chunk_mask) == 0) || data.size() >= chunk_max_size) {
+				cut();
+			}
+		}
+	}
+	if (!data.empty()) {
+		cut();
+	}
+
+	hash = content.finish();
+	return !stream.bad();
+}
+
+/*
+ * Internally used by the install function
+ *
+ * Reads a chunk from a file and checks it against its hash.
+*/
+bool TemplateSync::read_chunk(file_input &stream, const TemplateChunk &chunk, vector<char> &data)
+{
+	data.resize(chunk.size);
+	stream.clear();
+	stream.seekg(static_cast<std::streamoff>(chunk.offset));
+	stream.read(data.data(), static_cast<std::streamsize>(chunk.size));
+
+	if (!stream || static_cast<uint64_t>(stream.gcount()) != chunk.size) {
+		return false;
+	}
+
+	return fmt::format("{0:016x}", XXH3_64bits(data.data(), data.size())) == chunk.hash;
+}
+
+/*
+ * Internally used by the install function
+ *
+ * Swaps the staged template into place. Without an atomic exchange, the installed template
+ * is renamed aside first and restored if the staged one cannot take its place,
+ * so the destination is never left without a template.
+*/
+bool TemplateSync::swap(const file_path &staging_path, const file_path &destination)
+{
+	file_path previous_path = destination.parent_path().string() + separator + "." +
+		destination.filename().string() + ".proyekgen-old-" + to_string(steady_clock::now().time_since_epoch().count());
+	bool installed = filesystem::exists(destination);
+	error_code error;
+
+#if defined(__linux__)
+	if (installed && renameat2(AT_FDCWD, staging_path.string().c_str(), AT_FDCWD, destination.string().c_str(),
+		RENAME_EXCHANGE) == 0) {
+		// The staging path now holds the previously installed template
+		filesystem::remove_all(staging_path, error);
+		return true;
+	}
+#endif
+	if (installed) {
+		filesystem::rename(destination, previous_path, error);
+
+		if (error) {
+			fmt::print("Cannot install template to {0:s}: {1:s}\n", destination, error.message());
+			return false;
+		}
+	}
+
+	filesystem::rename(staging_path, destination, error);
+
+	if (error) {
+		fmt::print("Cannot install template to {0:s}: {1:s}\n", destination, error.message());
+
+		if (installed) {
+			filesystem::rename(previous_path, destination, error);
+		}
+
+		return false;
+	}
+	if (installed) {
+		filesystem::remove_all(previous_path, error);
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the install and write_index functions
+*/
+json TemplateSync::index_json(const vector<TemplateChunkFile> &files)
+{
+	json index = {{"version", 2}, {"chunk_size", chunk_mask + 1}, {"files", json::object()}};
+
+	for (const TemplateChunkFile &file : files) {
+		json chunks = json::array();
+
+		for (const TemplateChunk &c : file.chunks) {
+			chunks.push_back({c.size, c.hash});
+		}
+
+		index["files"][file.path] = {{"size", file.size}, {"xxh3", file.hash}, {"chunks", chunks}};
+	}
+
+	return index;
+}
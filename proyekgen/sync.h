@@ -0,0 +1,75 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "hash.h"
+#include "system.h"
+
+/*
+ * A content-defined chunk of a template file, located by its offset.
+*/
+struct TemplateChunk
+{
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	string hash;
+};
+
+/*
+ * A file of a template directory split into chunks.
+ *
+ * The content hash (XXH3) of the whole file tells if the chunks are still up to date.
+*/
+struct TemplateChunkFile
+{
+	string path;
+	uintmax_t size = 0;
+	string hash;
+	vector<TemplateChunk> chunks;
+};
+
+/*
+ * A class that installs and updates templates from a mirror (a local directory or a mounted file server).
+ *
+ * Files are split into chunks at positions chosen by a rolling hash of their contents,
+ * so changing a part of a file only changes the chunks around it. Chunks the installed template
+ * already has are copied locally, only the others are read from the mirror. Every staged file is
+ * checked against its content hash. The template is rebuilt in a staging directory next to it
+ * and swapped into its search path at once.
+*/
+class TemplateSync
+{
+public:
+	TemplateSync(const file_path &source);
+
+	file_path source();
+	bool install(const file_path &destination, bool update);
+	static bool write_index(const file_path &directory);
+
+	static const string index_name;
+
+private:
+	static bool scan(const file_path &directory, vector<TemplateChunkFile> &files, size_t &unindexed, bool verify);
+	static bool chunk(const file_path &path, vector<TemplateChunk> &chunks, string &hash);
+	static bool read_chunk(file_input &stream, const TemplateChunk &chunk, vector<char> &data);
+	static bool swap(const file_path &staging_path, const file_path &destination);
+	static json index_json(const vector<TemplateChunkFile> &files);
+
+	file_path _source;
+};
@@ -18,6 +18,8 @@
 
 #include "system.h"
 
+SystemVerbosity SystemRuntime::_verbosity = SystemVerbosity::normal;
+
 /*
  * Returns if current user that executed this program is
  * an administrator or has root privileges.
@@ -74,6 +76,71 @@ void SystemRuntime::fatal(int code)
 	exit(code);
 }
 
+/*
+ * Returns if progress messages of a verbosity level should be printed.
+*/
+bool SystemRuntime::verbose(SystemVerbosity level)
+{
+	return _verbosity >= level;
+}
+
+/*
+ * Set the progress verbosity by its name (quiet, normal or verbose).
+ *
+ * Returns false if the name is unknown.
+*/
+bool SystemRuntime::set_verbosity(const string &name)
+{
+	if (name == "quiet") {
+		_verbosity = SystemVerbosity::quiet;
+	} else if (name == "normal") {
+		_verbosity = SystemVerbosity::normal;
+	} else if (name == "verbose") {
+		_verbosity = SystemVerbosity::verbose;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Run a task for every index below count on a pool of threads.
+ *
+ * Zero threads uses every available core. The first exception thrown
+ * by a task is rethrown once every thread has finished.
+*/
+void SystemRuntime::parallel(size_t count, unsigned threads, const function<void, size_t> &task)
+{
+	atomic<size_t> next{0};
+	exception_ptr failure;
+	mutex failure_mutex;
+	vector<thread> workers;
+
+	threads = (threads > 0) ? threads : std::max(thread::hardware_concurrency(), 1u);
+	threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+	for (unsigned t = 0; t < threads; t++) {
+		workers.emplace_back([&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				try {
+					task(i);
+				} catch (...) {
+					lock_guard lock(failure_mutex);
+					failure = (failure == nullptr) ? std::current_exception() : failure;
+					next = count;
+				}
+			}
+		});
+	}
+	for (thread &worker : workers) {
+		worker.join();
+	}
+	if (failure != nullptr) {
+		std::rethrow_exception(failure);
+	}
+}
+
 /*
  * Get the global configuration path.
 */
@@ -224,6 +291,17 @@ file_path SystemBasePaths::local_templates_path()
 	return local_data_path().string() + separator + "templates";
 }
 
+/*
+ * Get the local cache path
+ *
+ * This returns the local_data_path function
+ * with the preferred path separator and "cache"
+*/
+file_path SystemBasePaths::local_cache_path()
+{
+	return local_data_path().string() + separator + "cache";
+}
+
 /*
  * Get the executable path
  * 
@@ -299,3 +377,66 @@ vector<file_path> SystemPaths::template_paths()
 		SystemBasePaths::local_templates_path(),
 		current_path().string() + separator + ".proyekgen" + separator + "templates"};
 }
+
+/*
+ * Returns true if a relative path stays inside the directory it's relative to.
+ *
+ * Absolute paths, paths with a root name and paths with ".." components are rejected.
+*/
+bool SystemPaths::is_contained(const file_path &path)
+{
+	if (path.empty() || path.is_absolute() || path.has_root_name() || path.has_root_directory()) {
+		return false;
+	}
+	for (const file_path &component : path) {
+		if (component == "..") {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Returns true if a symlink at a relative path points inside the directory the path is relative to.
+ *
+ * The target has to be relative, and ".." components are only allowed at its start,
+ * so following other contained symlinks on the way never leads outside of the directory.
+*/
+bool SystemPaths::is_contained_link(const file_path &path, const file_path &target)
+{
+	bool leading = true;
+
+	if (target.empty() || target.is_absolute() || target.has_root_name() || target.has_root_directory()) {
+		return false;
+	}
+	for (const file_path &component : target) {
+		if (component == ".." && !leading) {
+			return false;
+		}
+		if (component != ".." && component != ".") {
+			leading = false;
+		}
+	}
+
+	return is_contained((path.parent_path() / target).lexically_normal());
+}
+
+/*
+ * Returns true if a parent directory of a relative path is one of the symlinks (listed by their
+ * normalized generic paths), writing the path would then follow the symlink.
+*/
+bool SystemPaths::is_linked(const file_path &path, const unordered_set<string> &links)
+{
+	file_path parent;
+
+	for (const file_path &component : path.lexically_normal().parent_path()) {
+		parent /= component;
+
+		if (links.count(parent.generic_string())) {
+			return true;
+		}
+	}
+
+	return false;
+}
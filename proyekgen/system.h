@@ -25,6 +25,16 @@ using std::getline;
 using std::to_string;
 using std::transform;
 
+/*
+ * How much progress is printed while generating.
+*/
+enum class SystemVerbosity
+{
+	quiet,
+	normal,
+	verbose
+};
+
 /*
  * An utility class that provides runtime functions.
 */
@@ -34,6 +44,12 @@ public:
 	static bool is_root();
 	static string input(const string &msg);
 	static void fatal(int code = EXIT_FAILURE);
+	static bool verbose(SystemVerbosity level = SystemVerbosity::verbose);
+	static bool set_verbosity(const string &name);
+	static void parallel(size_t count, unsigned threads, const function<void, size_t> &task);
+
+private:
+	static SystemVerbosity _verbosity;
 };
 
 /*
@@ -51,6 +67,7 @@ public:
 	static file_path local_config_path();
 	static file_path local_data_path();
 	static file_path local_templates_path();
+	static file_path local_cache_path();
 };
 
 /*
@@ -64,4 +81,7 @@ public:
 	static vector<file_path> config_paths();
 	static vector<file_path> data_paths();
 	static vector<file_path> template_paths();
+	static bool is_contained(const file_path &path);
+	static bool is_contained_link(const file_path &path, const file_path &target);
+	static bool is_linked(const file_path &path, const unordered_set<string> &links);
 };
@@ -28,7 +28,7 @@ TemplateProject::TemplateProject()
 /*
  * Returns the path of the template's project file.
 */
-file_path TemplateProject::path()
+file_path TemplateProject::path() const
 {
 	return _path;
 }
@@ -41,42 +41,450 @@ void TemplateProject::set_path(const file_path& path)
 	_path = path;
 }
 
+/*
+ * Returns the filter that decides which files are extracted.
+*/
+TemplateFilter TemplateProject::filter() const
+{
+	return _filter;
+}
+
+/*
+ * Set the filter that decides which files are extracted.
+*/
+void TemplateProject::set_filter(const TemplateFilter &filter)
+{
+	_filter = filter;
+}
+
+/*
+ * Returns the project files of the base templates, the lowest layer first.
+*/
+vector<file_path> TemplateProject::bases() const
+{
+	return _bases;
+}
+
+/*
+ * Set the project files of the base templates, the lowest layer first.
+ *
+ * Files of the project override the files of its bases, which are never written.
+*/
+void TemplateProject::set_bases(const vector<file_path> &bases)
+{
+	_bases = bases;
+}
+
+/*
+ * Returns the digests of the template's project files.
+*/
+const TemplateDigests &TemplateProject::digests() const
+{
+	return _digests;
+}
+
+/*
+ * Returns how much file metadata is restored when extracting the project.
+*/
+TemplateMetadataPolicy TemplateProject::metadata() const
+{
+	return _metadata;
+}
+
+/*
+ * Set the digests of the template's project files.
+ *
+ * Only the files of the project itself are checked, not the files of its bases.
+*/
+void TemplateProject::set_digests(const TemplateDigests &digests)
+{
+	_digests = digests;
+}
+
+/*
+ * Enable or disable failing the extraction if a file doesn't match its digest.
+*/
+void TemplateProject::set_verify(bool verify)
+{
+	_digests.set_verify(verify);
+}
+
+/*
+ * Set how much file metadata is restored when extracting the project, including its bases.
+*/
+void TemplateProject::set_metadata(TemplateMetadataPolicy metadata)
+{
+	_metadata = metadata;
+}
+
+/*
+ * Set how files are materialized if the project data lives in the template store.
+*/
+void TemplateProject::set_store_link(TemplateStoreLink link)
+{
+	_store_link = link;
+}
+
+/*
+ * Set the size of the blocks read from the project data.
+ *
+ * Memory used while extracting stays bounded by the block size regardless of the file sizes.
+*/
+void TemplateProject::set_buffer_size(size_t size)
+{
+	_buffer_size = std::max<size_t>(size, 512);
+}
+
+/*
+ * Set the size from which files are preallocated and written sparsely.
+*/
+void TemplateProject::set_large_size(uintmax_t size)
+{
+	_large_size = size;
+}
+
+/*
+ * Enable or disable incremental regeneration.
+ *
+ * In update mode, files whose content already matches the generated project
+ * are skipped and files modified by the user are reported instead of being overwritten.
+*/
+void TemplateProject::set_update(bool update)
+{
+	_update = update;
+}
+
+/*
+ * Set the number of threads used for extracting bundles, zero uses every available core.
+*/
+void TemplateProject::set_threads(unsigned threads)
+{
+	_threads = threads;
+}
+
+/*
+ * Returns the paths of the files in the template project, including the files of its bases.
+*/
+vector<string> TemplateProject::list() const
+{
+	vector<string> result;
+	unordered_set<string> listed;
+
+	for (const TemplatePlanEntry &entry : list_layer(_path)) {
+		result.push_back(entry.path);
+		listed.insert(entry.path);
+	}
+	for (auto base = _bases.rbegin(); base != _bases.rend(); base++) {
+		for (const TemplatePlanEntry &entry : list_layer(*base)) {
+			if (listed.insert(entry.path).second) {
+				result.push_back(entry.path);
+			}
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Returns the files that extracting the template project into a destination would write.
+ *
+ * Nothing is read from the destination except whether the files already exist there,
+ * the filter and the layers are applied the same way as the extract function does.
+*/
+vector<TemplatePlanEntry> TemplateProject::plan(const string &dest) const
+{
+	vector<TemplatePlanEntry> result;
+	TemplateFilter filter = _filter;
+	vector<file_path> layers = {_path};
+	layers.insert(layers.end(), _bases.rbegin(), _bases.rend());
+
+	for (size_t i = 0; i < layers.size(); i++) {
+		if (i > 0) {
+			filter.shadow();
+		}
+		for (TemplatePlanEntry &entry : list_layer(layers[i])) {
+			if (!filter.claim(entry.path)) {
+				continue;
+			}
+
+			// Paths that cannot be checked (e.g. in an unreadable directory) are shown as missing instead of throwing
+			file_path target = dest + separator + TemplateFilter::normalize(entry.path);
+			error_code error;
+			filesystem::file_status status = filesystem::symlink_status(target, error);
+			entry.conflict = filesystem::exists(status) && !(entry.directory && filesystem::is_directory(status));
+			result.push_back(std::move(entry));
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Internally used by the list and plan functions
+ *
+ * Bundles and store manifests are listed from their index, tar archives
+ * are listed by skipping over the data of every entry.
+*/
+vector<TemplatePlanEntry> TemplateProject::list_layer(const file_path &path)
+{
+	vector<TemplatePlanEntry> result;
+
+	if (path.filename() == TemplateBundle::bundle_name) {
+		TemplateBundle bundle = TemplateBundle(path);
+
+		if (bundle.open()) {
+			for (size_t i = 0; i < bundle.size(); i++) {
+				TemplateBundleEntry e = bundle.entry(i);
+				result.push_back({e.path, e.size, (e.mode & AE_IFMT) == AE_IFDIR});
+			}
+		}
+
+		return result;
+	}
+	if (path.filename() == TemplateStore::manifest_name) {
+		file_input stream(path);
+		json manifest_json = json::parse(stream, nullptr, false);
+		TemplateStore store = TemplateStore(manifest_json.value("store", string()));
+		error_code error;
+
+		for (const json &item : manifest_json.value("entries", json::array())) {
+			TemplatePlanEntry entry = {item.value("path", string())};
+			entry.directory = item.value("type", string()) == "directory";
+
+			if (item.value("type", string()) == "file") {
+				// Manifests don't record sizes, the blob has the same size as the file
+				entry.size = filesystem::file_size(store.blob_path(item.value("hash", string())), error);
+				entry.size = error ? 0 : entry.size;
+			}
+
+			result.push_back(std::move(entry));
+		}
+
+		return result;
+	}
+
+	struct archive *reader = archive_read_new();
+	struct archive_entry *entry;
+	archive_read_support_format_tar(reader);
+	archive_read_support_filter_xz(reader);
+	archive_read_support_filter_zstd(reader);
+
+	if (open_layer(reader, path, 10240) == ARCHIVE_OK) {
+		while (archive_read_next_header(reader, &entry) == ARCHIVE_OK) {
+			la_int64_t size = archive_entry_size(entry);
+			result.push_back({archive_entry_pathname(entry), static_cast<uintmax_t>(std::max<la_int64_t>(size, 0)),
+				archive_entry_filetype(entry) == AE_IFDIR});
+			archive_read_data_skip(reader);
+		}
+	}
+
+	archive_read_free(reader);
+	return result;
+}
+
+/*
+ * Extract a single file of the template project (or its bases) to a specified destination
+*/
+bool TemplateProject::pull(const string &pathname, const string &dest) const
+{
+	file_path target = dest + separator + pathname;
+	vector<char> data;
+	bool found = false;
+	error_code error;
+
+	// Layers are searched from the top
+	vector<file_path> layers = {_path};
+	layers.insert(layers.end(), _bases.rbegin(), _bases.rend());
+
+	for (size_t i = 0; i < layers.size() && !found; i++) {
+		found = read_layer(layers[i], pathname, data);
+	}
+	if (!found) {
+		fmt::print("Cannot find file in template data: {0:s}\n", pathname);
+		return false;
+	}
+
+	filesystem::create_directories(target.parent_path(), error);
+	file_output stream(target, std::ios::binary | std::ios::trunc);
+	stream.write(data.data(), data.size());
+
+	if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+		fmt::print("Writing file: {0:s}\n", pathname);
+	}
+
+	return static_cast<bool>(stream);
+}
+
+/*
+ * Internally used by the list, pull and extract functions
+ *
+ * Opens the tar archive of a layer, embedded archives are read from memory.
+*/
+int TemplateProject::open_layer(struct archive *reader, const file_path &path, size_t block_size)
+{
+	const unsigned char *data;
+	size_t size;
+
+	if (TemplateEmbedded::find(path, data, size)) {
+		return archive_read_open_memory(reader, data, size);
+	}
+
+	return archive_read_open_filename(reader, path.string().c_str(), block_size);
+}
+
+/*
+ * Internally used by the pull function
+ *
+ * Bundles only decompress the chunk containing the file.
+*/
+bool TemplateProject::read_layer(const file_path &path, const string &pathname, vector<char> &data)
+{
+	bool found = false;
+
+	if (path.filename() == TemplateBundle::bundle_name) {
+		TemplateBundle bundle = TemplateBundle(path);
+		TemplateBundleEntry entry;
+		found = bundle.open() && bundle.find(pathname, entry) && bundle.read(entry, data);
+	} else if (path.filename() == TemplateStore::manifest_name) {
+		file_input stream(path);
+		json manifest_json = json::parse(stream, nullptr, false);
+		TemplateStore store = TemplateStore(manifest_json.value("store", string()));
+
+		for (const json &item : manifest_json.value("entries", json::array())) {
+			if (item.value("path", string()) == pathname && item.value("type", string()) == "file") {
+				file_input blob(store.blob_path(item.value("hash", string())), std::ios::binary);
+				data.assign(std::istreambuf_iterator<char>(blob), std::istreambuf_iterator<char>());
+				found = blob.is_open();
+				break;
+			}
+		}
+	} else {
+		struct archive *reader = archive_read_new();
+		struct archive_entry *entry;
+		archive_read_support_format_tar(reader);
+		archive_read_support_filter_xz(reader);
+		archive_read_support_filter_zstd(reader);
+
+		if (open_layer(reader, path, 10240) == ARCHIVE_OK) {
+			while (!found && archive_read_next_header(reader, &entry) == ARCHIVE_OK) {
+				if (pathname != archive_entry_pathname(entry) || archive_entry_filetype(entry) != AE_IFREG) {
+					archive_read_data_skip(reader);
+					continue;
+				}
+
+				data.resize(static_cast<size_t>(std::max<la_int64_t>(archive_entry_size(entry), 0)));
+				found = archive_read_data(reader, data.data(), data.size()) == static_cast<la_ssize_t>(data.size());
+			}
+		}
+
+		archive_read_free(reader);
+	}
+
+	return found;
+}
+
 /*
  * Extract the template project to a specified destination
  * 
- * This function returns the result of file extraction, and sometimes
- * may cause a fatal error if the file does not exist / is not a file /
- * is inaccessible.
+ * This function returns the result of file extraction, which is false
+ * if the file does not exist / is not a file / is inaccessible.
+ *
+ * Templates imported into the template store are materialized from their manifest.
+ * A manifest of the written files is stored inside the destination, on updates the
+ * files that were removed from the template are removed as well. Files excluded
+ * by the filter's feature groups are skipped, and files of base templates overridden
+ * by an upper layer are never written.
 */
 bool TemplateProject::extract(const string &dest)
 {
+	ProjectManifest manifest = ProjectManifest(dest);
+	TemplateFilter filter = _filter;
+	bool extracted;
+
+	if (_update && !manifest.load()) {
+		fmt::print("No project manifest found, every existing file is treated as modified.\n");
+	}
+
+	// Layers are extracted from the top, files written by a layer are skipped in its bases.
+	// Only the top layer has digests, its listed files must all have been extracted
+	extracted = extract_layer(_path, dest, manifest, filter, _digests) && _digests.complete(filter);
+
+	for (auto base = _bases.rbegin(); extracted && base != _bases.rend(); base++) {
+		filter.shadow();
+		extracted = extract_layer(*base, dest, manifest, filter, TemplateDigests());
+	}
+	if (extracted && _update) {
+		manifest.prune();
+	}
+	if (_update) {
+		fmt::print("Updated project: {0:s}\n", manifest.summary());
+	}
+
+	return extracted && manifest.save();
+}
+
+/*
+ * Stream the project data into an archive instead of extracting it.
+ *
+ * Layers are streamed from the top like when extracting, nothing is written to disk.
+*/
+bool TemplateProject::stream(ProjectStream &stream) const
+{
+	TemplateFilter filter = _filter;
+	bool streamed = stream_layer(_path, stream, filter, _digests) && _digests.complete(filter);
+
+	for (auto base = _bases.rbegin(); streamed && base != _bases.rend(); base++) {
+		filter.shadow();
+		streamed = stream_layer(*base, stream, filter, TemplateDigests());
+	}
+
+	return streamed;
+}
+
+/*
+ * Internally used by the extract function
+ *
+ * Extracts a single layer of the template project, skipping the files the filter doesn't claim.
+ * Files are checked against the layer's digests using the hashes computed while they're copied.
+*/
+bool TemplateProject::extract_layer(const file_path &path, const string &dest, ProjectManifest &manifest,
+	TemplateFilter &filter, const TemplateDigests &digests)
+{
+	if (path.filename() == TemplateStore::manifest_name) {
+		return TemplateStore::materialize(path, dest, _store_link, _metadata, manifest, _update, filter, digests);
+	}
+	if (path.filename() == TemplateBundle::bundle_name) {
+		TemplateBundle bundle = TemplateBundle(path);
+		bundle.set_metadata(_metadata);
+		return bundle.extract(dest, manifest, _update, filter, digests, _threads);
+	}
+
 	struct archive *reader;
 	struct archive *writer;
 	struct archive_entry *entry;
 	file_path cwd = SystemPaths::current_path();
+	steady_clock::time_point start = steady_clock::now();
+	uintmax_t total_size = 0;
+	string staged_path;
+	bool failed = false;
 	int result;
-	int flags;
-
-	flags = ARCHIVE_EXTRACT_TIME;
-	flags |= ARCHIVE_EXTRACT_PERM;
-	flags |= ARCHIVE_EXTRACT_ACL;
-	flags |= ARCHIVE_EXTRACT_FFLAGS;
 
 	chdir(dest.c_str());
 
 	reader = archive_read_new();
 	archive_read_support_format_tar(reader);
 	archive_read_support_filter_xz(reader);
+	archive_read_support_filter_zstd(reader);
 	writer = archive_write_disk_new();
-	archive_write_disk_set_options(writer, flags);
-	archive_write_disk_set_standard_lookup(writer);
-	result = archive_read_open_filename(reader, _path.string().c_str(), 10240);
+	archive_write_disk_set_options(writer, TemplateMetadata::extract_flags(_metadata));
+	TemplateMetadata::set_lookup(writer, _metadata);
+	result = open_layer(reader, path, _buffer_size);
 
 	if (result != ARCHIVE_OK) {
-		fmt::print("Failed to read template data: {0:s}", _path);
-		SystemRuntime::fatal();
+		fmt::print("Failed to read template data: {0:s}\n", path);
+		failed = true;
 	}
-	for (;;) {
+	while (!failed) {
 		result = archive_read_next_header(reader, &entry);
 
 		if (result == ARCHIVE_EOF) {
@@ -84,27 +492,89 @@ bool TemplateProject::extract(const string &dest)
 		}
 		if (result < ARCHIVE_OK) {
 			fmt::print("{0:s}\n", archive_error_string(reader));
-			return false;
+			failed = true;
+			break;
 		}
 		if (result < ARCHIVE_WARN) {
-			return false;
+			failed = true;
+			break;
+		}
+
+		string pathname = archive_entry_pathname(entry);
+		total_size += static_cast<uintmax_t>(std::max<la_int64_t>(archive_entry_size(entry), 0));
+		bool regular = archive_entry_filetype(entry) == AE_IFREG && archive_entry_hardlink(entry) == nullptr;
+		// The manifest records XXH3 digests
+		HashDigest hash(true, digests.cryptographic());
+
+		if (!SystemPaths::is_contained(file_path(pathname).lexically_normal())) {
+			fmt::print("Refusing to write outside the project: {0:s}\n", pathname);
+			failed = true;
+			break;
+		}
+		if (!filter.claim(pathname)) {
+			// Excluded files are skipped without decompressing their data into the writer
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping excluded file: {0:s}\n", pathname);
+			}
+
+			archive_read_data_skip(reader);
+			continue;
+		}
+		if (_update && regular) {
+			// Regular files are compared against the project before writing anything
+			if (update(reader, writer, entry, manifest, digests) < ARCHIVE_WARN) {
+				failed = true;
+				break;
+			}
+
+			continue;
+		}
+
+		// In verify mode listed files are written to a temporary file first,
+		// they are only moved into place once their digest matched
+		bool staged = regular && digests.verify() && digests.listed(pathname);
+		string target = staged ? pathname + ".proyekgen-tmp" : pathname;
+		staged_path = staged ? target : string();
+
+		if (large_entry(entry)) {
+			// Large assets bypass the disk writer to preallocate and keep holes
+			if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+				fmt::print("Writing file: {0:s}\n", pathname);
+			}
+
+			if (copy_large(reader, entry, target, hash) < ARCHIVE_WARN || !digests.check(pathname, hash) ||
+				(staged && !place(target, pathname))) {
+				failed = true;
+				break;
+			}
+
+			manifest.record(pathname, hash.xxh3());
+			continue;
+		}
+		if (staged) {
+			archive_entry_set_pathname(entry, target.c_str());
 		}
 
 		result = archive_write_header(writer, entry);
-		fmt::print("Writing file: {0:s}\n", archive_entry_pathname(entry));
 
+		if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+			fmt::print("Writing file: {0:s}\n", pathname);
+		}
 		if (result < ARCHIVE_OK) {
 			fmt::print("{0:s}\n", archive_error_string(writer));
-			return false;
+			failed = true;
+			break;
 		} else if (archive_entry_size(entry) > 0) {
-			result = copy(reader, writer);
+			result = copy(reader, writer, hash);
 
 			if (result < ARCHIVE_OK) {
 				fmt::print("{0:s}\n", archive_error_string(writer));
-				return false;
+				failed = true;
+				break;
 			}
 			if (result < ARCHIVE_WARN) {
-				return false;
+				failed = true;
+				break;
 			}
 		}
 
@@ -112,46 +582,348 @@ bool TemplateProject::extract(const string &dest)
 
 		if (result < ARCHIVE_OK) {
 			fmt::print("{0:s}\n", archive_error_string(writer));
-			return false;
+			failed = true;
+			break;
 		}
 		if (result < ARCHIVE_WARN) {
-			return false;
+			failed = true;
+			break;
+		}
+		if (regular && (!digests.check(pathname, hash) || (staged && !place(target, pathname)))) {
+			failed = true;
+			break;
+		}
+		if (regular) {
+			manifest.record(pathname, hash.xxh3());
+		}
+	}
+	if (failed && !staged_path.empty()) {
+		// A file that failed (or mismatched) in verify mode is never left in the project
+		unlink(staged_path.c_str());
+	}
+
+	archive_read_free(reader);
+	archive_write_free(writer);
+	chdir(cwd.string().c_str());
+
+	if (failed) {
+		return false;
+	}
+
+	if (SystemRuntime::verbose()) {
+		double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+		fmt::print("Extracted {0:.1f} MiB in {1:.2f}s ({2:.1f} MiB/s)\n", total_size / 1048576.0, seconds,
+			(seconds > 0) ? total_size / 1048576.0 / seconds : 0.0);
+	}
+
+	return true;
+}
+
+/*
+ * Internally used by the stream function
+ *
+ * Streams a single layer of the template project, entries are passed from the reader to the stream.
+*/
+bool TemplateProject::stream_layer(const file_path &path, ProjectStream &stream, TemplateFilter &filter,
+	const TemplateDigests &digests) const
+{
+	if (path.filename() == TemplateStore::manifest_name) {
+		return TemplateStore::stream(path, stream, filter, digests);
+	}
+	if (path.filename() == TemplateBundle::bundle_name) {
+		TemplateBundle bundle = TemplateBundle(path);
+		return bundle.stream(stream, filter, digests);
+	}
+
+	struct archive *reader;
+	struct archive_entry *entry;
+	bool failed = false;
+	int result;
+
+	reader = archive_read_new();
+	archive_read_support_format_tar(reader);
+	archive_read_support_filter_xz(reader);
+	archive_read_support_filter_zstd(reader);
+	result = open_layer(reader, path, _buffer_size);
+
+	if (result != ARCHIVE_OK) {
+		fmt::print("Failed to read template data: {0:s}\n", path);
+		failed = true;
+	}
+	while (!failed) {
+		result = archive_read_next_header(reader, &entry);
+
+		if (result == ARCHIVE_EOF) {
+			break;
+		}
+		if (result < ARCHIVE_WARN) {
+			fmt::print("{0:s}\n", archive_error_string(reader));
+			failed = true;
+			break;
+		}
+
+		string pathname = archive_entry_pathname(entry);
+		bool regular = archive_entry_filetype(entry) == AE_IFREG && archive_entry_hardlink(entry) == nullptr;
+		HashDigest hash(digests.checksum(), digests.cryptographic());
+
+		if (!SystemPaths::is_contained(file_path(pathname).lexically_normal())) {
+			fmt::print("Refusing to write outside the project: {0:s}\n", pathname);
+			failed = true;
+			break;
+		}
+		if (!filter.claim(pathname)) {
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping excluded file: {0:s}\n", pathname);
+			}
+
+			archive_read_data_skip(reader);
+			continue;
+		}
+		if (!stream.add_reader(entry, reader, digests.empty() ? nullptr : &hash)) {
+			failed = true;
+			break;
+		}
+		if (regular && !digests.check(pathname, hash)) {
+			failed = true;
+			break;
+		}
+	}
+
+	archive_read_free(reader);
+	return !failed;
+}
+
+/*
+ * Internally used by the extract function
+ *
+ * The data is hashed while it is copied.
+*/
+int TemplateProject::copy(struct archive *r, struct archive *w, HashDigest &hash)
+{
+	static const char zeros[4096] = {};
+	const void *buffer;
+	la_int64_t offset;
+	la_int64_t position = 0;
+	size_t size;
+	int result;
+
+	for (;;) {
+		result = archive_read_data_block(r, &buffer, &size, &offset);
+
+		if (result == ARCHIVE_EOF) {
+			return ARCHIVE_OK;
+		}
+		if (result < ARCHIVE_OK) {
+			return result;
+		}
+		for (; position < offset; position += sizeof(zeros)) {
+			// Holes of sparse entries are hashed as zeros
+			hash.update(zeros, static_cast<size_t>(std::min<la_int64_t>(offset - position, sizeof(zeros))));
+		}
+
+		result = archive_write_data_block(w, buffer, size, offset);
+		hash.update(buffer, size);
+		position = offset + size;
+
+		if (result < ARCHIVE_OK) {
+			fmt::print("{0:s}\n", archive_error_string(w));
+			return result;
+		}
+	}
+}
+
+/*
+ * Internally used by the extract function in update mode
+ *
+ * The entry's data is read, hashed and checked against the digests first,
+ * it is only written if the file is new or unmodified by the user.
+*/
+int TemplateProject::update(struct archive *r, struct archive *w, struct archive_entry *entry,
+	ProjectManifest &manifest, const TemplateDigests &digests)
+{
+	string pathname = archive_entry_pathname(entry);
+	string temp_path = pathname + ".proyekgen-tmp";
+	bool large = large_entry(entry);
+	vector<char> data;
+	HashDigest hash(true, digests.cryptographic());
+	const void *buffer;
+	la_int64_t offset;
+	size_t size;
+	int result;
+
+	if (large) {
+		// Large entries are streamed into a temporary file instead of memory
+		result = copy_large(r, entry, temp_path, hash);
+
+		if (result < ARCHIVE_OK) {
+			return result;
+		}
+	} else {
+		data.reserve(static_cast<size_t>(std::max<la_int64_t>(archive_entry_size(entry), 0)));
+	}
+	while (!large) {
+		result = archive_read_data_block(r, &buffer, &size, &offset);
+
+		if (result == ARCHIVE_EOF) {
+			break;
+		}
+		if (result < ARCHIVE_OK) {
+			fmt::print("{0:s}\n", archive_error_string(r));
+			return result;
+		}
+		if (static_cast<size_t>(offset) > data.size()) {
+			// Fill holes of sparse entries
+			data.resize(static_cast<size_t>(offset));
+		}
+
+		data.insert(data.end(), static_cast<const char*>(buffer), static_cast<const char*>(buffer) + size);
+	}
+
+	hash.update(data.data(), data.size());
+	string digest = hash.xxh3();
+	error_code error;
+
+	if (!digests.check(pathname, hash)) {
+		filesystem::remove(temp_path, error);
+		return ARCHIVE_FATAL;
+	}
+
+	ProjectManifestStatus status = manifest.compare(pathname, digest);
+
+	if (large && status != ProjectManifestStatus::created && status != ProjectManifestStatus::updated) {
+		filesystem::remove(temp_path, error);
+	}
+
+	switch (status) {
+	case ProjectManifestStatus::unchanged:
+		manifest.record(pathname, digest);
+		return ARCHIVE_OK;
+	case ProjectManifestStatus::modified:
+		fmt::print("Keeping modified file: {0:s}\n", pathname);
+		return ARCHIVE_OK;
+	case ProjectManifestStatus::conflict:
+		fmt::print("Conflict: {0:s} was modified locally, keeping local changes\n", pathname);
+		return ARCHIVE_OK;
+	case ProjectManifestStatus::created:
+		if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+			fmt::print("Writing file: {0:s}\n", pathname);
 		}
+		break;
+	case ProjectManifestStatus::updated:
+		if (SystemRuntime::verbose(SystemVerbosity::normal)) {
+			fmt::print("Updating file: {0:s}\n", pathname);
+		}
+		break;
+	}
+	if (large) {
+		filesystem::rename(temp_path, pathname, error);
+
+		if (error) {
+			fmt::print("Cannot write file {0:s}: {1:s}\n", pathname, error.message());
+			filesystem::remove(temp_path, error);
+			return ARCHIVE_FATAL;
+		}
+
+		manifest.record(pathname, digest);
+		return ARCHIVE_OK;
 	}
 
-	archive_read_free(reader);
-	archive_write_free(writer);
-	chdir(cwd.string().c_str());
-	return true;
+	result = archive_write_header(w, entry);
+
+	if (result == ARCHIVE_OK && !data.empty()) {
+		result = (archive_write_data(w, data.data(), data.size()) < 0) ? ARCHIVE_FATAL : ARCHIVE_OK;
+	}
+	if (result == ARCHIVE_OK) {
+		result = archive_write_finish_entry(w);
+	}
+	if (result < ARCHIVE_OK) {
+		fmt::print("{0:s}\n", archive_error_string(w));
+		return result;
+	}
+
+	manifest.record(pathname, digest);
+	return ARCHIVE_OK;
 }
 
 /*
- * Internally used by the extract function
+ * Internally used by the extract function for large entries
+ *
+ * Holes of sparse entries are kept and hashed as zeros. Only libarchive's
+ * read buffer is kept in memory regardless of the entry size.
 */
-int TemplateProject::copy(struct archive *r, struct archive *w)
+int TemplateProject::copy_large(struct archive *r, struct archive_entry *entry, const string &target,
+	HashDigest &hash)
 {
+	static const char zeros[4096] = {};
+	la_int64_t size = archive_entry_size(entry);
+	ProjectLargeFile file(target, _metadata);
 	const void *buffer;
 	la_int64_t offset;
-	size_t size;
+	la_int64_t position = 0;
+	size_t block_size;
 	int result;
 
+	if (!file.open(static_cast<uint64_t>(size), archive_entry_perm(entry), archive_entry_sparse_count(entry) != 0)) {
+		return ARCHIVE_FATAL;
+	}
 	for (;;) {
-		result = archive_read_data_block(r, &buffer, &size, &offset);
+		result = archive_read_data_block(r, &buffer, &block_size, &offset);
 
 		if (result == ARCHIVE_EOF) {
-			return ARCHIVE_OK;
+			break;
 		}
 		if (result < ARCHIVE_OK) {
+			fmt::print("{0:s}\n", archive_error_string(r));
 			return result;
 		}
+		for (; position < offset; position += sizeof(zeros)) {
+			hash.update(zeros, static_cast<size_t>(std::min<la_int64_t>(offset - position, sizeof(zeros))));
+		}
+		if (!file.write(buffer, block_size, static_cast<uint64_t>(offset))) {
+			return ARCHIVE_FATAL;
+		}
 
-		result = archive_write_data_block(w, buffer, size, offset);
+		hash.update(buffer, block_size);
+		position = offset + block_size;
+	}
+	for (; position < size; position += sizeof(zeros)) {
+		hash.update(zeros, static_cast<size_t>(std::min<la_int64_t>(size - position, sizeof(zeros))));
+	}
 
-		if (result < ARCHIVE_OK) {
-			fmt::print("{0:s}\n", archive_error_string(w));
-			return result;
-		}
+	return file.close(archive_entry_perm(entry), archive_entry_mtime(entry)) ? ARCHIVE_OK : ARCHIVE_FATAL;
+}
+
+/*
+ * Internally used by the extract function
+ *
+ * Returns true if an entry is written through copy_large.
+*/
+bool TemplateProject::large_entry(struct archive_entry *entry)
+{
+#if defined(__linux__)
+	return archive_entry_filetype(entry) == AE_IFREG && archive_entry_hardlink(entry) == nullptr &&
+		archive_entry_size(entry) >= static_cast<la_int64_t>(_large_size);
+#else
+	return false;
+#endif
+}
+
+/*
+ * Internally used by the extract function
+ *
+ * Moves a verified file from its temporary path into place.
+*/
+bool TemplateProject::place(const string &temp_path, const string &pathname)
+{
+	error_code error;
+	filesystem::rename(temp_path, pathname, error);
+
+	if (error) {
+		fmt::print("Cannot write file {0:s}: {1:s}\n", pathname, error.message());
+		return false;
 	}
+
+	return true;
 }
 
 TemplateRunner::TemplateRunner(const file_path & path)
@@ -165,24 +937,93 @@ TemplateRunner::TemplateRunner()
 	init();
 }
 
-file_path TemplateRunner::path()
+file_path TemplateRunner::path() const
 {
 	return _path;
 }
 
+/*
+ * Returns the declared inputs of the runner.
+*/
+const TemplateRunnerInputs &TemplateRunner::inputs() const
+{
+	return _inputs;
+}
+
+/*
+ * Returns the declared outputs of the runner.
+ *
+ * Outputs are relative to the output directory.
+*/
+const vector<file_path> &TemplateRunner::outputs() const
+{
+	return _outputs;
+}
+
+/*
+ * Returns true if the runner's results can be memoized.
+ *
+ * Only runners that declare their outputs are cacheable.
+*/
+bool TemplateRunner::cacheable() const
+{
+	return !_outputs.empty();
+}
+
+/*
+ * Returns the SHA-256 digest of the runner script.
+*/
+string TemplateRunner::digest() const
+{
+	const unsigned char *data;
+	size_t size;
+
+	if (TemplateEmbedded::find(_path, data, size)) {
+		HashSha256 hash;
+		hash.update(data, size);
+		return hash.finish();
+	}
+
+	return HashSha256::file(_path);
+}
+
 void TemplateRunner::set_path(const file_path &path)
 {
 	_path = path;
 }
 
+void TemplateRunner::set_inputs(const TemplateRunnerInputs &inputs)
+{
+	_inputs = inputs;
+}
+
+void TemplateRunner::set_outputs(const vector<file_path> &outputs)
+{
+	_outputs = outputs;
+}
+
 void TemplateRunner::execute()
 {
-	if (!filesystem::is_regular_file(_path)) {
+	const unsigned char *data;
+	size_t size;
+	bool loaded;
+
+	if (TemplateEmbedded::find(_path, data, size)) {
+		// Embedded runners are loaded from memory
+		loaded = luaL_loadbuffer(_lua, reinterpret_cast<const char*>(data), size, _path.string().c_str()) == LUA_OK &&
+			lua_pcall(_lua, 0, 0, 0) == LUA_OK;
+	} else if (filesystem::is_regular_file(_path)) {
+		loaded = luaL_dofile(_lua, _path.string().c_str()) == LUA_OK;
+	} else {
 		fmt::print("{0:s} is not a valid Lua script.", _path);
 		SystemRuntime::fatal();
 	}
+	if (!loaded) {
+		const char *message = lua_tostring(_lua, -1);
+		fmt::print("Cannot load runner {0:s}: {1:s}\n", _path, (message != nullptr) ? message : "unknown error");
+		SystemRuntime::fatal();
+	}
 
-	luaL_dofile(_lua, _path.string().c_str());
 	lua_getglobal(_lua, "_pgen_main");
 	int result = lua_pcall(_lua, 0, 0, 0);
 
@@ -204,7 +1045,7 @@ void TemplateRunner::init()
 }
 
 TemplateBase::TemplateBase(TemplateProject project, vector<TemplateRunner> runners)
-	: _project(project), _runners(runners)
+	: _project(std::move(project)), _runners(std::move(runners))
 {}
 
 TemplateBase::TemplateBase()
@@ -213,7 +1054,7 @@ TemplateBase::TemplateBase()
 /*
  * Returns the template's project
 */
-TemplateProject TemplateBase::project()
+const TemplateProject &TemplateBase::project() const
 {
 	return _project;
 }
@@ -221,7 +1062,7 @@ TemplateProject TemplateBase::project()
 /*
  * Returns the template's runners
 */
-vector<TemplateRunner> TemplateBase::runners()
+const vector<TemplateRunner> &TemplateBase::runners() const
 {
 	return _runners;
 }
@@ -231,7 +1072,7 @@ vector<TemplateRunner> TemplateBase::runners()
 */
 void TemplateBase::set_project(TemplateProject project)
 {
-	_project = project;
+	_project = std::move(project);
 }
 
 /*
@@ -239,12 +1080,12 @@ void TemplateBase::set_project(TemplateProject project)
 */
 void TemplateBase::set_runners(vector<TemplateRunner> runners)
 {
-	_runners = runners;
+	_runners = std::move(runners);
 }
 
 Template::Template(TemplateProject project, vector<TemplateRunner> runners,
 	const string &name, const string &author, file_path path)
-	: TemplateBase(project, runners), _name(name), _author(author), _path(path) 
+	: TemplateBase(std::move(project), std::move(runners)), _name(name), _author(author), _path(path) 
 {}
 
 Template::Template()
@@ -256,7 +1097,7 @@ Template::Template()
  * An identifier is used for searching specific templates in proyekgen.
  * The identifier is extracted from the directory name of the template data.
 */
-string Template::identifier()
+string Template::identifier() const
 {
 	return _path.filename().string();
 }
@@ -264,7 +1105,7 @@ string Template::identifier()
 /*
  * Returns the template name
 */
-string Template::name()
+const string &Template::name() const
 {
 	return _name;
 }
@@ -272,7 +1113,7 @@ string Template::name()
 /*
  * Returns the template author
 */
-string Template::author()
+const string &Template::author() const
 {
 	return _author;
 }
@@ -280,11 +1121,56 @@ string Template::author()
 /*
  * Returns the fully-qualified path of the template
 */
-file_path Template::path()
+const file_path &Template::path() const
 {
 	return _path;
 }
 
+/*
+ * Returns the template description
+*/
+const string &Template::description() const
+{
+	return _description;
+}
+
+/*
+ * Returns the template tags
+*/
+const vector<string> &Template::tags() const
+{
+	return _tags;
+}
+
+/*
+ * Returns the identifiers of the template's base templates
+*/
+const vector<string> &Template::bases() const
+{
+	return _bases;
+}
+
+/*
+ * Returns the value of a template variable
+ *
+ * Template variables can be declared as runner inputs,
+ * unknown variables return an empty string.
+*/
+string Template::variable(const string &name) const
+{
+	if (name == "identifier") {
+		return identifier();
+	} else if (name == "name") {
+		return _name;
+	} else if (name == "author") {
+		return _author;
+	} else if (name == "path") {
+		return _path.string();
+	}
+
+	return string();
+}
+
 /*
  * Set the template's name
 */
@@ -301,14 +1187,40 @@ void Template::set_author(const string& author)
 	_author = author;
 }
 
-TemplateLibrary::TemplateLibrary(const vector<string> &paths)
+/*
+ * Set the template's description
+*/
+void Template::set_description(const string &description)
+{
+	_description = description;
+}
+
+/*
+ * Set the template's tags
+*/
+void Template::set_tags(const vector<string> &tags)
+{
+	_tags = tags;
+}
+
+/*
+ * Set the identifiers of the template's base templates
+*/
+void Template::set_bases(const vector<string> &bases)
+{
+	_bases = bases;
+}
+
+TemplateLibrary::TemplateLibrary(const vector<string> &paths, const string &format, unsigned threads,
+	const string &identifier)
+	: project_format(format), threads(threads)
 {
 	// Add additional search paths passed from the constructor arguments
 	search_paths.insert(search_paths.end(), make_move_iterator(paths.begin()),
 		make_move_iterator(paths.end()));
 
-	// Initialize for searching templates
-	init();
+	// Initialize for searching templates, only the requested one if it's embedded
+	init(identifier);
 }
 
 TemplateLibrary::TemplateLibrary()
@@ -320,7 +1232,7 @@ TemplateLibrary::TemplateLibrary()
 /*
  * Get the list of templates installed.
 */
-vector<Template> TemplateLibrary::list()
+const vector<Template> &TemplateLibrary::list() const
 {
 	return templates;
 }
@@ -331,21 +1243,28 @@ vector<Template> TemplateLibrary::list()
  * This function may cause the program to lead
  * in a fatal error if the template doesn't exist.
 */
-Template TemplateLibrary::get(const string &name)
+const Template &TemplateLibrary::get(const string &name) const
 {
-	if (!exists(name)) {
+	const Template *t = find(name);
+
+	if (t == nullptr) {
 		fmt::print("Cannot find template with the matching name: {0:s}\n", name);
 		SystemRuntime::fatal();
 	}
-	for (Template t : templates) {
-		if (t.identifier() != name) {
-			continue;
-		}
 
-		return t;
-	}
+	return *t;
+}
 
-	return Template();
+/*
+ * Find the template using the specified name
+ *
+ * Returns a null pointer if the template doesn't exist, the pointer
+ * stays valid as long as the library does.
+*/
+const Template *TemplateLibrary::find(const string &name) const
+{
+	auto it = index.find(name);
+	return (it != index.end()) ? &templates[it->second] : nullptr;
 }
 
 /*
@@ -356,82 +1275,362 @@ Template TemplateLibrary::get(const string &name)
  * This function may cause the program to lead
  * in a fatal error if the template doesn't exist.
 */
-bool TemplateLibrary::remove(string name)
+bool TemplateLibrary::remove(const string &name)
 {
-	if (!exists(name)) {
-		fmt::print("Cannot find template with the matching name: {0:s}\n", name);
-		SystemRuntime::fatal();
-	}
-	
-	Template t = get(name);
-	std::uintmax_t result = filesystem::remove_all(t.path());
+	std::uintmax_t result = filesystem::remove_all(get(name).path());
 	return (result > 0) ? true : false;
 }
 
 /*
  * Returns true if template exists.
 */
-bool TemplateLibrary::exists(const string &name)
+bool TemplateLibrary::exists(const string &name) const
+{
+	return index.count(name) > 0;
+}
+
+/*
+ * Initialize library.
+ * 
+ * This function searches for templates and stores them into a vector container.
+ * Search paths are listed and templates are loaded on a pool of threads, the results
+ * are merged in search path order so the first template of an identifier still wins.
+ * Embedded templates come last, so installed templates of the same identifier override them.
+ *
+ * If a template is requested and it's embedded, only the embedded templates it needs are loaded
+ * without listing the search paths, unless a search path has a template directory of its name.
+*/
+void TemplateLibrary::init(const string &identifier)
 {
-	for (Template t : templates) {
-		if (t.identifier() != name) {
+	if (!identifier.empty() && init_embedded(identifier)) {
+		return;
+	}
+
+	vector<vector<file_path>> listings(search_paths.size());
+	vector<file_path> candidates;
+
+	SystemRuntime::parallel(search_paths.size(), threads, [&](size_t i) {
+		if (!filesystem::is_directory(search_paths[i])) {
+			return;
+		}
+		for (const dir_entry& entry : filesystem::directory_iterator{ search_paths[i] }) {
+			listings[i].push_back(entry.path());
+		}
+	});
+
+	for (vector<file_path> &listing : listings) {
+		candidates.insert(candidates.end(), make_move_iterator(listing.begin()),
+			make_move_iterator(listing.end()));
+	}
+
+	vector<Template> loaded(candidates.size());
+	vector<char> found(candidates.size(), false);
+
+	SystemRuntime::parallel(candidates.size(), threads, [&](size_t i) {
+		found[i] = load(candidates[i], loaded[i]);
+	});
+
+	for (size_t i = 0; i < candidates.size(); i++) {
+		if (!found[i]) {
 			continue;
 		}
 
-		return true;
+		// Add template to vector container, the first template of an identifier wins lookups
+		templates.push_back(std::move(loaded[i]));
+		index.emplace(templates.back().identifier(), templates.size() - 1);
 	}
+	for (const string &embedded : TemplateEmbedded::templates()) {
+		Template t;
 
-	return false;
+		if (index.count(embedded) == 0 && load_embedded(embedded, t)) {
+			templates.push_back(std::move(t));
+			index.emplace(embedded, templates.size() - 1);
+		}
+	}
+
+	resolve();
 }
 
 /*
- * Initialize library.
- * 
- * This function searches for templates and stores them into a vector container.
+ * Internally used by the init function
+ *
+ * Loads an embedded template and its embedded bases. Returns false (and loads nothing)
+ * if any of them isn't embedded or is installed in a search path.
+*/
+bool TemplateLibrary::init_embedded(const string &identifier)
+{
+	vector<string> pending = {identifier};
+
+	while (!pending.empty()) {
+		string current = pending.back();
+		Template t;
+
+		pending.pop_back();
+
+		if (index.count(current) > 0) {
+			continue;
+		}
+		if (!load_embedded(current, t) || installed(current)) {
+			templates.clear();
+			index.clear();
+			return false;
+		}
+
+		pending.insert(pending.end(), t.bases().begin(), t.bases().end());
+		templates.push_back(std::move(t));
+		index.emplace(current, templates.size() - 1);
+	}
+
+	resolve();
+	return true;
+}
+
+/*
+ * Internally used by the init_embedded function
+ *
+ * Returns true if a search path has a template directory of the identifier.
 */
-void TemplateLibrary::init()
+bool TemplateLibrary::installed(const string &identifier) const
 {
+	error_code error;
+
 	for (const file_path &path : search_paths) {
-		if (!filesystem::is_directory(path)) {
+		if (filesystem::is_regular_file(path / identifier / "info.json", error)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Internally used by the init functions
+ *
+ * Replaces every template with bases by the composition of its layers.
+*/
+void TemplateLibrary::resolve()
+{
+	// Layers are resolved from the templates as declared before any of them is changed
+	vector<Template> resolved;
+
+	for (size_t i = 0; i < templates.size(); i++) {
+		resolved.push_back(templates[i].bases().empty() ? Template() : compose(i));
+	}
+	for (size_t i = 0; i < templates.size(); i++) {
+		if (!templates[i].bases().empty()) {
+			templates[i] = std::move(resolved[i]);
+		}
+	}
+}
+
+/*
+ * Internally used by the resolve function
+ *
+ * Returns a template with the project files, runners and feature groups of all its layers,
+ * the bases come first in their declared order and the template itself last.
+*/
+Template TemplateLibrary::compose(size_t position) const
+{
+	Template result = templates[position];
+	TemplateProject project = result.project();
+	TemplateFilter filter = project.filter();
+	vector<TemplateRunner> runners;
+	vector<file_path> bases;
+	vector<size_t> layers;
+	vector<size_t> stack;
+
+	collect(position, layers, stack);
+	layers.pop_back();
+
+	for (size_t layer : layers) {
+		const Template &base = templates[layer];
+		bases.push_back(base.project().path());
+		runners.insert(runners.end(), base.runners().begin(), base.runners().end());
+	}
+	for (auto layer = layers.rbegin(); layer != layers.rend(); layer++) {
+		// Feature groups of upper layers override groups of the same name
+		filter.merge(templates[*layer].project().filter());
+	}
+
+	runners.insert(runners.end(), result.runners().begin(), result.runners().end());
+	project.set_bases(bases);
+	project.set_filter(filter);
+	result.set_project(project);
+	result.set_runners(runners);
+	return result;
+}
+
+/*
+ * Internally used by the compose function
+ *
+ * Collects the layers of a template depth-first, every template appears once.
+*/
+void TemplateLibrary::collect(size_t position, vector<size_t> &layers, vector<size_t> &stack) const
+{
+	if (std::find(stack.begin(), stack.end(), position) != stack.end()) {
+		fmt::print("Template {0:s} inherits from itself, ignoring the cycle\n", templates[position].identifier());
+		return;
+	}
+
+	stack.push_back(position);
+
+	for (const string &base : templates[position].bases()) {
+		auto it = index.find(base);
+
+		if (it == index.end()) {
+			fmt::print("Cannot find base template {0:s} of {1:s}\n", base, templates[position].identifier());
 			continue;
 		}
-		for (const dir_entry& entry : filesystem::directory_iterator{ path }) {
-			string path = entry.path().string();
-			string path_filename = entry.path().filename().string();
-			file_path project_path = path + separator + "project.tar.xz";
-			file_path info_path = path + separator + "info.json";
 
-			if (!filesystem::is_regular_file(project_path) || !filesystem::is_regular_file(info_path)) {
-				continue;
+		collect(it->second, layers, stack);
+	}
+
+	stack.pop_back();
+
+	if (std::find(layers.begin(), layers.end(), position) == layers.end()) {
+		layers.push_back(position);
+	}
+}
+
+/*
+ * Internally used by the init function
+ *
+ * Returns false if the directory doesn't contain a template.
+*/
+bool TemplateLibrary::load(const file_path &directory, Template &result) const
+{
+	string path = directory.string();
+	file_path info_path = path + separator + "info.json";
+	file_path project_path;
+
+	// Templates imported into the template store come first, then indexed bundles
+	// and tar archives, unless another format is preferred. Bundles older than the
+	// tar archive next to them are outdated and skipped
+	vector<pair<string, string>> project_files = {{"manifest", TemplateStore::manifest_name},
+		{"bundle", TemplateBundle::bundle_name}, {"tar", "project.tar.xz"}, {"tar", "project.tar.zst"}};
+	std::stable_partition(project_files.begin(), project_files.end(),
+		[this](const pair<string, string> &f) { return f.first == project_format; });
+
+	for (const pair<string, string> &project_file : project_files) {
+		if (!filesystem::is_regular_file(path + separator + project_file.second)) {
+			continue;
+		}
+		if (project_file.first == "bundle" &&
+			TemplateBundle(path + separator + project_file.second).outdated()) {
+			if (SystemRuntime::verbose()) {
+				fmt::print("Skipping outdated bundle: {0:s}\n", path + separator + project_file.second);
 			}
 
-			// Info
-			json info_json = json::object();
-			file_input info_stream(info_path);
-			info_json = json::parse(info_stream);
+			continue;
+		}
+
+		project_path = path + separator + project_file.second;
+		break;
+	}
+
+	if (!filesystem::is_regular_file(project_path) || !filesystem::is_regular_file(info_path)) {
+		return false;
+	}
+
+	// Info
+	json info_json = json::object();
+	file_input info_stream(info_path);
+	info_json = json::parse(info_stream);
 
-			string name = (info_json.contains("name")) ? static_cast<string>(info_json["name"]) : path_filename;
-			string author = (info_json.contains("author")) ? static_cast<string>(info_json["author"]) : "unknown";
+	result = parse(directory, project_path, info_json);
+	return true;
+}
 
-			// Project Data
-			TemplateProject project = TemplateProject(project_path);
+/*
+ * Internally used by the init function
+ *
+ * Embedded templates are loaded from memory, their project data is always a tar archive.
+*/
+bool TemplateLibrary::load_embedded(const string &identifier, Template &result) const
+{
+	file_path directory = TemplateEmbedded::root_path / identifier;
+	const unsigned char *data;
+	size_t size;
 
-			// Runners
-			json runners_json = (info_json.contains("runners")) ? info_json["runners"] : json::array();
-			vector<TemplateRunner> runners;
+	if (!TemplateEmbedded::find(directory / "info.json", data, size)) {
+		return false;
+	}
 
-			for (auto &r : runners_json) {
-				file_path runner = r;
+	json info_json = json::parse(data, data + size);
 
-				if (runner.is_relative()) {
-					runner = path + separator + runner.string();
-				}
+	for (const char *project_file : {"project.tar.xz", "project.tar.zst"}) {
+		if (TemplateEmbedded::find(directory / project_file, data, size)) {
+			result = parse(directory, directory / project_file, info_json);
+			return true;
+		}
+	}
 
-				runners.push_back(TemplateRunner(runner));
-			}
+	return false;
+}
+
+/*
+ * Internally used by the load functions
+ *
+ * Returns the template described by an info.json, relative runner paths
+ * are resolved against the template directory.
+*/
+Template TemplateLibrary::parse(const file_path &directory, const file_path &project_path, const json &info_json)
+{
+	string path = directory.string();
+	string path_filename = directory.filename().string();
+	string name = (info_json.contains("name")) ? static_cast<string>(info_json["name"]) : path_filename;
+	string author = (info_json.contains("author")) ? static_cast<string>(info_json["author"]) : "unknown";
+
+	// Project Data
+	TemplateProject project = TemplateProject(project_path);
+	project.set_filter(TemplateFilter(info_json.value("features", json::object())));
+	project.set_digests(TemplateDigests(info_json.value("digests", json::object())));
+
+	if (info_json.contains("metadata")) {
+		TemplateMetadataPolicy metadata;
+
+		if (TemplateMetadata::parse_policy(info_json.value("metadata", string()), metadata)) {
+			project.set_metadata(metadata);
+		} else {
+			fmt::print("Unknown metadata policy in template {0:s}: {1:s}\n", path_filename,
+				info_json.value("metadata", string()));
+		}
+	}
+
+	// Runners
+	json runners_json = (info_json.contains("runners")) ? info_json["runners"] : json::array();
+	vector<TemplateRunner> runners;
 
-			// Add template to vector container
-			templates.push_back(Template(project, runners, name, author, path));
+	for (const json &r : runners_json) {
+		// Runners are either a script path or an object declaring inputs and outputs
+		file_path runner_path = (r.is_object()) ? r.value("path", string()) : r.get<string>();
+		TemplateRunnerInputs runner_inputs;
+		vector<file_path> runner_outputs;
+
+		if (runner_path.is_relative()) {
+			runner_path = path + separator + runner_path.string();
+		}
+		if (r.is_object() && r.contains("inputs")) {
+			const json &inputs_json = r["inputs"];
+			runner_inputs.files = inputs_json.value("files", vector<string>());
+			runner_inputs.env = inputs_json.value("env", vector<string>());
+			runner_inputs.variables = inputs_json.value("variables", vector<string>());
 		}
+		if (r.is_object() && r.contains("outputs")) {
+			for (const json &output : r["outputs"]) {
+				runner_outputs.push_back(output.get<string>());
+			}
+		}
+
+		TemplateRunner runner = TemplateRunner(runner_path);
+		runner.set_inputs(runner_inputs);
+		runner.set_outputs(runner_outputs);
+		runners.push_back(std::move(runner));
 	}
+
+	Template result = Template(std::move(project), std::move(runners), name, author, path);
+	result.set_description(info_json.value("description", string()));
+	result.set_tags(info_json.value("tags", vector<string>()));
+	result.set_bases(info_json.value("base", vector<string>()));
+	return result;
 }
@@ -18,10 +18,33 @@
 
 #pragma once
 #include "global.h"
+#include "bundle.h"
+#include "digest.h"
+#include "embedded.h"
+#include "filter.h"
+#include "hash.h"
+#include "large.h"
+#include "manifest.h"
+#include "metadata.h"
+#include "store.h"
+#include "stream.h"
 #include "system.h"
 
 using std::make_move_iterator;
 
+/*
+ * A file of the template project, as listed without extracting its data.
+ *
+ * Conflicts are files that already exist in the output directory.
+*/
+struct TemplatePlanEntry
+{
+	string path;
+	uintmax_t size = 0;
+	bool directory = false;
+	bool conflict = false;
+};
+
 /*
  * A class that provides the project data of a template.
 */
@@ -31,14 +54,66 @@ public:
 	TemplateProject(const file_path &path);
 	TemplateProject();
 
-	file_path path();
+	file_path path() const;
+	TemplateFilter filter() const;
+	vector<file_path> bases() const;
+	const TemplateDigests &digests() const;
+	TemplateMetadataPolicy metadata() const;
 	void set_path(const file_path &path);
+	void set_bases(const vector<file_path> &bases);
+	void set_filter(const TemplateFilter &filter);
+	void set_digests(const TemplateDigests &digests);
+	void set_verify(bool verify);
+	void set_metadata(TemplateMetadataPolicy metadata);
+	void set_store_link(TemplateStoreLink link);
+	void set_buffer_size(size_t size);
+	void set_large_size(uintmax_t size);
+	void set_update(bool update);
+	void set_threads(unsigned threads);
+	vector<string> list() const;
+	vector<TemplatePlanEntry> plan(const string &dest) const;
+	bool pull(const string &pathname, const string &dest) const;
 	bool extract(const string &dest);
+	bool stream(ProjectStream &stream) const;
 
 private:
-	int copy(struct archive *r, struct archive *w);
+	static vector<TemplatePlanEntry> list_layer(const file_path &path);
+	static bool read_layer(const file_path &path, const string &pathname, vector<char> &data);
+	static int open_layer(struct archive *reader, const file_path &path, size_t block_size);
+	bool extract_layer(const file_path &path, const string &dest, ProjectManifest &manifest,
+		TemplateFilter &filter, const TemplateDigests &digests);
+	bool stream_layer(const file_path &path, ProjectStream &stream, TemplateFilter &filter,
+		const TemplateDigests &digests) const;
+	int copy(struct archive *r, struct archive *w, HashDigest &hash);
+	int copy_large(struct archive *r, struct archive_entry *entry, const string &target, HashDigest &hash);
+	int update(struct archive *r, struct archive *w, struct archive_entry *entry,
+		ProjectManifest &manifest, const TemplateDigests &digests);
+	bool large_entry(struct archive_entry *entry);
+	static bool place(const string &temp_path, const string &pathname);
 
 	file_path _path;
+	vector<file_path> _bases;
+	TemplateFilter _filter;
+	TemplateDigests _digests;
+	TemplateMetadataPolicy _metadata = TemplateMetadataPolicy::full;
+	TemplateStoreLink _store_link = TemplateStoreLink::reflink;
+	size_t _buffer_size = 10240;
+	uintmax_t _large_size = 16 * 1024 * 1024;
+	bool _update = false;
+	unsigned _threads = 0;
+};
+
+/*
+ * Declared inputs of a runner, used for memoizing its outputs.
+ *
+ * Files are relative to the output directory, environment variables
+ * and template variables are referenced by their names.
+*/
+struct TemplateRunnerInputs
+{
+	vector<string> files;
+	vector<string> env;
+	vector<string> variables;
 };
 
 /*
@@ -50,14 +125,22 @@ public:
 	TemplateRunner(const file_path &path);
 	TemplateRunner();
 
-	file_path path();
+	file_path path() const;
+	const TemplateRunnerInputs &inputs() const;
+	const vector<file_path> &outputs() const;
+	bool cacheable() const;
+	string digest() const;
 	void set_path(const file_path & path);
+	void set_inputs(const TemplateRunnerInputs &inputs);
+	void set_outputs(const vector<file_path> &outputs);
 	void execute();
 
 private:
 	void init();
 
 	file_path _path;
+	TemplateRunnerInputs _inputs;
+	vector<file_path> _outputs;
 	lua_State *_lua = nullptr;
 };
 
@@ -72,8 +155,8 @@ public:
 	TemplateBase(TemplateProject project, vector<TemplateRunner> runners);
 	TemplateBase();
 
-	TemplateProject project();
-	vector<TemplateRunner> runners();
+	const TemplateProject &project() const;
+	const vector<TemplateRunner> &runners() const;
 	void set_project(TemplateProject project);
 	void set_runners(vector<TemplateRunner> runners);
 
@@ -92,17 +175,27 @@ public:
 		const string &name, const string &author, file_path path = string());
 	Template();
 
-	string identifier();
-	string name();
-	string author();
-	file_path path();
+	string identifier() const;
+	const string &name() const;
+	const string &author() const;
+	const file_path &path() const;
+	const string &description() const;
+	const vector<string> &tags() const;
+	const vector<string> &bases() const;
+	string variable(const string &name) const;
 	void set_name(const string& name);
 	void set_author(const string& author);
+	void set_description(const string &description);
+	void set_tags(const vector<string> &tags);
+	void set_bases(const vector<string> &bases);
 
 private:
 	string _name;
 	string _author;
 	file_path _path;
+	string _description;
+	vector<string> _tags;
+	vector<string> _bases;
 };
 
 /*
@@ -111,17 +204,30 @@ private:
 class TemplateLibrary
 {
 public:
-	TemplateLibrary(const vector<string> &paths);
+	TemplateLibrary(const vector<string> &paths, const string &format = string(), unsigned threads = 0,
+		const string &identifier = string());
 	TemplateLibrary();
 
-	vector<Template> list();
-	Template get(const string &keyword);
-	bool remove(string keyword);
-	bool exists(const string &keyword);
+	const vector<Template> &list() const;
+	const Template &get(const string &keyword) const;
+	const Template *find(const string &keyword) const;
+	bool remove(const string &keyword);
+	bool exists(const string &keyword) const;
 
 private:
-	void init();
+	void init(const string &identifier = string());
+	bool init_embedded(const string &identifier);
+	bool installed(const string &identifier) const;
+	void resolve();
+	bool load(const file_path &directory, Template &result) const;
+	bool load_embedded(const string &identifier, Template &result) const;
+	static Template parse(const file_path &directory, const file_path &project_path, const json &info_json);
+	Template compose(size_t position) const;
+	void collect(size_t position, vector<size_t> &layers, vector<size_t> &stack) const;
 	
 	vector<Template> templates = {};
+	unordered_map<string, size_t> index;
 	vector<file_path> search_paths = SystemPaths::template_paths();
+	string project_format;
+	unsigned threads = 0;
 };
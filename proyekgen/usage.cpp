@@ -0,0 +1,214 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "usage.h"
+
+thread TemplateUsage::_prewarm_thread;
+atomic<bool> TemplateUsage::_prewarm_stopped{false};
+
+TemplateUsage::TemplateUsage(const file_path &path)
+	: _path(path)
+{}
+
+TemplateUsage::TemplateUsage()
+{}
+
+/*
+ * Returns the path of the usage file.
+*/
+file_path TemplateUsage::path()
+{
+	return _path;
+}
+
+/*
+ * Record a generation using the template in the specified directory.
+ *
+ * Concurrent runs are serialized by a lock file, a run waits for the others to record
+ * their generations first. The usage file is replaced through a temporary file.
+*/
+bool TemplateUsage::record(const file_path &template_path)
+{
+	file_path temp_path = _path.string() + ".tmp-" + to_string(steady_clock::now().time_since_epoch().count());
+	int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	error_code error;
+
+	filesystem::create_directories(_path.parent_path(), error);
+#if !defined(_WIN32)
+	int lock_fd = open((_path.string() + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	while (lock_fd >= 0 && flock(lock_fd, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			close(lock_fd);
+			return false;
+		}
+	}
+#endif
+
+	json usage = read();
+	json &entry = usage["templates"][template_path.string()];
+	uint64_t count = entry.is_object() ? entry.value("count", static_cast<uint64_t>(0)) : 0;
+	entry = {{"count", count + 1}, {"last_used", now}};
+
+	file_output stream(temp_path);
+	stream << usage.dump(1, '\t') << "\n";
+	stream.close();
+
+	if (stream) {
+		filesystem::rename(temp_path, _path, error);
+	}
+	if (!stream || error) {
+		filesystem::remove(temp_path, error);
+	}
+#if !defined(_WIN32)
+	if (lock_fd >= 0) {
+		close(lock_fd);
+	}
+#endif
+
+	return static_cast<bool>(stream);
+}
+
+/*
+ * Returns the most used templates that still exist, ordered by their counts
+ * and by their last use if their counts are equal.
+*/
+vector<TemplateUsageEntry> TemplateUsage::most_used(size_t count)
+{
+	json usage = read();
+	vector<TemplateUsageEntry> entries;
+	error_code error;
+
+	for (auto &item : usage["templates"].items()) {
+		TemplateUsageEntry entry;
+
+		if (!item.value().is_object()) {
+			continue;
+		}
+
+		entry.path = item.key();
+		entry.count = item.value().value("count", static_cast<uint64_t>(0));
+		entry.last_used = item.value().value("last_used", static_cast<int64_t>(0));
+
+		if (filesystem::is_directory(entry.path, error)) {
+			entries.push_back(entry);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const TemplateUsageEntry &a, const TemplateUsageEntry &b) {
+		return (a.count != b.count) ? a.count > b.count : a.last_used > b.last_used;
+	});
+
+	if (entries.size() > count) {
+		entries.resize(count);
+	}
+
+	return entries;
+}
+
+/*
+ * Read the files of a template directory ahead into the page cache.
+ *
+ * The reads are only requested, this function doesn't wait for them. Stops early once
+ * background prewarming is stopped. Returns the number of files, or zero if the current
+ * OS has no implementation.
+*/
+size_t TemplateUsage::prewarm(const file_path &template_path)
+{
+	size_t files = 0;
+#if defined(__linux__)
+	error_code error;
+
+	for (const dir_entry &e : filesystem::recursive_directory_iterator{ template_path, error }) {
+		if (_prewarm_stopped) {
+			break;
+		}
+		if (!e.is_regular_file(error)) {
+			continue;
+		}
+
+		int fd = open(e.path().string().c_str(), O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0) {
+			continue;
+		}
+		if (posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0) {
+			files++;
+		}
+
+		close(fd);
+	}
+#endif
+
+	return files;
+}
+
+/*
+ * Prewarm templates on a background thread while the current run continues.
+ *
+ * The thread is stopped after the file it's reading and joined when the process exits
+ * (including exits through SystemRuntime::fatal), so it never outlives the objects it uses.
+*/
+void TemplateUsage::prewarm_background(const vector<file_path> &template_paths)
+{
+	if (_prewarm_thread.joinable()) {
+		return;
+	}
+
+	std::atexit(stop_prewarm);
+	_prewarm_thread = thread([template_paths]() {
+		for (const file_path &path : template_paths) {
+			if (_prewarm_stopped) {
+				break;
+			}
+
+			prewarm(path);
+		}
+	});
+}
+
+/*
+ * Registered with atexit by the prewarm_background function
+*/
+void TemplateUsage::stop_prewarm()
+{
+	_prewarm_stopped = true;
+
+	if (_prewarm_thread.joinable()) {
+		_prewarm_thread.join();
+	}
+}
+
+/*
+ * Internally used by the record and most_used functions
+*/
+json TemplateUsage::read()
+{
+	file_input stream(_path);
+	json usage = stream.is_open() ? json::parse(stream, nullptr, false) : json::object();
+
+	if (!usage.is_object()) {
+		usage = json::object();
+	}
+	if (!usage.contains("templates") || !usage["templates"].is_object()) {
+		usage["templates"] = json::object();
+	}
+
+	return usage;
+}
@@ -0,0 +1,59 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "global.h"
+#include "system.h"
+
+/*
+ * How often a template was used to generate projects.
+*/
+struct TemplateUsageEntry
+{
+	file_path path;
+	uint64_t count = 0;
+	int64_t last_used = 0;
+};
+
+/*
+ * A class that records which templates are used, stored in the local data path (usage.json).
+ *
+ * The most used templates can be prewarmed, their files are read ahead into the page cache
+ * so the first generations after a reboot don't wait for the disk.
+*/
+class TemplateUsage
+{
+public:
+	TemplateUsage(const file_path &path);
+	TemplateUsage();
+
+	file_path path();
+	bool record(const file_path &template_path);
+	vector<TemplateUsageEntry> most_used(size_t count);
+	static size_t prewarm(const file_path &template_path);
+	static void prewarm_background(const vector<file_path> &template_paths);
+
+private:
+	json read();
+	static void stop_prewarm();
+
+	static thread _prewarm_thread;
+	static atomic<bool> _prewarm_stopped;
+
+	file_path _path = SystemBasePaths::local_data_path().string() + separator + "usage.json";
+};
@@ -0,0 +1,515 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * proyekgen-scale synthesizes template libraries at production scale and runs the real
+ * proyekgen binary against them, failing if a run exceeds its recorded budgets.
+ * Scenarios without recorded budgets are skipped (exit code 77) before anything is synthesized.
+ *
+ * Usage: proyekgen-scale <scenario> --binary <path> --work <path> --budgets <file> --strace <path>
+ *                        [--asset-size <bytes>] [--record]
+ *
+ * Scenarios:
+ *   discovery    lists a library of 10k templates
+ *   small-files  generates a template with 100k small files
+ *   large-asset  generates a template with a multi-GB asset
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/resource.h"
+#include "sys/wait.h"
+
+#include "archive.h"
+#include "archive_entry.h"
+#include "fmt/core.h"
+#include "nlohmann/json.hpp"
+
+namespace filesystem = std::filesystem;
+
+using error_code = std::error_code;
+using file_path = std::filesystem::path;
+using file_input = std::ifstream;
+using file_output = std::ofstream;
+using json = nlohmann::json;
+using steady_clock = std::chrono::steady_clock;
+using string = std::string;
+template<class T>
+using vector = std::vector<T, std::allocator<T>>;
+
+// Reported to CTest through SKIP_RETURN_CODE
+static const int scale_skip_code = 77;
+
+/*
+ * Parameters of a scenario, the corpus is only synthesized again if they change.
+*/
+struct ScaleScenario
+{
+	string name;
+	size_t templates = 0;
+	size_t files = 0;
+	uintmax_t asset_size = 0;
+};
+
+/*
+ * Measurements of a single run, also used for the budgets.
+ *
+ * Syscalls are counted with strace in a separate run.
+*/
+struct ScaleMeasurement
+{
+	double wall_seconds = 0;
+	double peak_rss_mib = 0;
+	uintmax_t syscalls = 0;
+};
+
+/*
+ * Options passed from the command line.
+*/
+struct ScaleOptions
+{
+	string scenario;
+	file_path binary;
+	file_path work;
+	file_path budgets;
+	file_path strace;
+	uintmax_t asset_size = 2ull * 1024 * 1024 * 1024;
+	bool record = false;
+};
+
+/*
+ * Run a function for every index on all available cores.
+*/
+static void scale_parallel(size_t count, const std::function<void(size_t)> &function)
+{
+	std::atomic<size_t> next{0};
+	vector<std::thread> workers;
+	unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	for (unsigned t = 0; t < threads; t++) {
+		workers.emplace_back([&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				function(i);
+			}
+		});
+	}
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+}
+
+/*
+ * Write a project.tar.xz, the writer function adds the entries.
+ *
+ * The lowest compression level is used, the corpus only has to be decompressed quickly.
+*/
+static bool scale_write_archive(const file_path &path, const std::function<bool(struct archive*)> &writer_function)
+{
+	struct archive *writer = archive_write_new();
+	bool written;
+
+	archive_write_set_format_pax_restricted(writer);
+	archive_write_add_filter_xz(writer);
+	archive_write_set_filter_option(writer, "xz", "compression-level", "1");
+	archive_write_set_filter_option(writer, "xz", "threads", "0");
+
+	if (archive_write_open_filename(writer, path.string().c_str()) != ARCHIVE_OK) {
+		fmt::print("Cannot write {0:s}: {1:s}\n", path.string(), archive_error_string(writer));
+		archive_write_free(writer);
+		return false;
+	}
+
+	written = writer_function(writer);
+	written = (archive_write_close(writer) == ARCHIVE_OK) && written;
+	archive_write_free(writer);
+	return written;
+}
+
+/*
+ * Add a directory or a file to an archive, the file's data is produced in blocks by the data function.
+*/
+static bool scale_write_entry(struct archive *writer, const string &pathname, uintmax_t size,
+	const std::function<void(uintmax_t, vector<char>&)> &data_function = nullptr)
+{
+	struct archive_entry *entry = archive_entry_new();
+	bool directory = pathname.back() == '/';
+	bool written = true;
+
+	archive_entry_set_pathname(entry, pathname.c_str());
+	archive_entry_set_filetype(entry, directory ? AE_IFDIR : AE_IFREG);
+	archive_entry_set_perm(entry, directory ? 0755 : 0644);
+	archive_entry_set_size(entry, static_cast<la_int64_t>(size));
+
+	if (archive_write_header(writer, entry) != ARCHIVE_OK) {
+		archive_entry_free(entry);
+		return false;
+	}
+
+	vector<char> block;
+
+	for (uintmax_t position = 0; written && position < size; position += block.size()) {
+		data_function(position, block);
+		block.resize(static_cast<size_t>(std::min<uintmax_t>(block.size(), size - position)));
+		written = archive_write_data(writer, block.data(), block.size()) == static_cast<la_ssize_t>(block.size());
+	}
+
+	archive_entry_free(entry);
+	return written;
+}
+
+/*
+ * Write a template directory with an info.json.
+*/
+static bool scale_write_template(const file_path &path, const string &name,
+	const std::function<bool(struct archive*)> &writer_function)
+{
+	json info = {{"name", name}, {"author", "proyekgen-scale"},
+		{"description", "Synthesized template " + name}, {"tags", {"scale", "synthetic"}}, {"runners", json::array()}};
+	error_code error;
+
+	filesystem::create_directories(path, error);
+	file_output stream(path.string() + "/info.json");
+	stream << info.dump(1, '\t') << "\n";
+	stream.close();
+	return static_cast<bool>(stream) && scale_write_archive(path.string() + "/project.tar.xz", writer_function);
+}
+
+/*
+ * Synthesize the template library of a scenario.
+*/
+static bool scale_synthesize(const ScaleScenario &scenario, const file_path &templates_path)
+{
+	std::atomic<bool> failed{false};
+
+	if (scenario.name == "discovery") {
+		scale_parallel(scenario.templates, [&](size_t i) {
+			string name = fmt::format("scale-{0:05d}", i);
+			bool written = scale_write_template(templates_path.string() + "/" + name, name, [&](struct archive *w) {
+				return scale_write_entry(w, "README.md", name.size(), [&](uintmax_t, vector<char> &block) {
+					block.assign(name.begin(), name.end());
+				});
+			});
+
+			if (!written) {
+				failed = true;
+			}
+		});
+	} else if (scenario.name == "small-files") {
+		failed = !scale_write_template(templates_path.string() + "/small-files", "small-files", [&](struct archive *w) {
+			for (size_t i = 0; i < scenario.files; i++) {
+				// A thousand files per directory
+				if (i % 1000 == 0 && !scale_write_entry(w, fmt::format("src/{0:03d}/", i / 1000), 0)) {
+					return false;
+				}
+
+				string content = fmt::format("// File {0:d} of a synthesized template\nint value_{0:d} = {0:d};\n", i);
+				bool written = scale_write_entry(w, fmt::format("src/{0:03d}/file{1:06d}.cpp", i / 1000, i),
+					content.size(), [&](uintmax_t, vector<char> &block) {
+					block.assign(content.begin(), content.end());
+				});
+
+				if (!written) {
+					return false;
+				}
+			}
+
+			return true;
+		});
+	} else if (scenario.name == "large-asset") {
+		failed = !scale_write_template(templates_path.string() + "/large-asset", "large-asset", [&](struct archive *w) {
+			return scale_write_entry(w, "assets/", 0) && scale_write_entry(w, "assets/large.bin", scenario.asset_size,
+				[](uintmax_t position, vector<char> &block) {
+				// Every MiB starts with 4 KiB of noise and is zero-filled otherwise
+				uint64_t state = position + 0x9e3779b97f4a7c15;
+				block.assign(1024 * 1024, '\0');
+
+				for (size_t i = 0; i < 4096; i++) {
+					state ^= state << 13;
+					state ^= state >> 7;
+					state ^= state << 17;
+					block[i] = static_cast<char>(state);
+				}
+			});
+		});
+	}
+
+	return !failed;
+}
+
+/*
+ * Run a command with its output redirected to a log file.
+ *
+ * Returns false if the command couldn't run or didn't exit successfully.
+*/
+static bool scale_execute(const vector<string> &arguments, const file_path &home, const file_path &log,
+	ScaleMeasurement &measurement)
+{
+	steady_clock::time_point start = steady_clock::now();
+	struct rusage usage = {};
+	int status = 0;
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		return false;
+	}
+	if (pid == 0) {
+		// The user's templates and configuration are kept out of the measurements
+		vector<char*> argv;
+		int fd = open(log.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		for (const string &argument : arguments) {
+			argv.push_back(const_cast<char*>(argument.c_str()));
+		}
+
+		argv.push_back(nullptr);
+		setenv("HOME", home.string().c_str(), 1);
+		setenv("XDG_CONFIG_HOME", (home.string() + "/.config").c_str(), 1);
+		setenv("XDG_DATA_HOME", (home.string() + "/.local/share").c_str(), 1);
+		setenv("XDG_CACHE_HOME", (home.string() + "/.cache").c_str(), 1);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &usage) < 0) {
+		return false;
+	}
+
+	measurement.wall_seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+	measurement.peak_rss_mib = usage.ru_maxrss / 1024.0;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * Returns the total number of syscalls from the summary of strace -c.
+ *
+ * The calls column is found by its header, strace leaves columns empty when they don't apply.
+*/
+static uintmax_t scale_parse_strace(const file_path &path)
+{
+	file_input stream(path);
+	string line;
+	size_t column = string::npos;
+
+	while (std::getline(stream, line)) {
+		if (line.find("calls") != string::npos && line.find("syscall") != string::npos) {
+			column = line.find("calls") + 5;
+		}
+		if (column == string::npos || line.find(" total") == string::npos || line.size() < column) {
+			continue;
+		}
+
+		string calls = line.substr(0, column);
+		calls = calls.substr(calls.find_last_of(' ') + 1);
+		return std::strtoull(calls.c_str(), nullptr, 10);
+	}
+
+	return 0;
+}
+
+/*
+ * Parse the command-line options, returns false on invalid usage.
+*/
+static bool scale_parse_options(int argc, char **argv, ScaleOptions &options)
+{
+	for (int i = 1; i < argc; i++) {
+		string argument = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (argument == "--record") {
+			options.record = true;
+		} else if (argument == "--binary" && has_value) {
+			options.binary = filesystem::absolute(argv[++i]);
+		} else if (argument == "--work" && has_value) {
+			options.work = filesystem::absolute(argv[++i]);
+		} else if (argument == "--budgets" && has_value) {
+			options.budgets = filesystem::absolute(argv[++i]);
+		} else if (argument == "--strace" && has_value) {
+			options.strace = argv[++i];
+		} else if (argument == "--asset-size" && has_value) {
+			options.asset_size = std::strtoull(argv[++i], nullptr, 10);
+		} else if (argument.rfind("--", 0) != 0 && options.scenario.empty()) {
+			options.scenario = argument;
+		} else {
+			return false;
+		}
+	}
+
+	return !options.scenario.empty() && !options.binary.empty() && !options.work.empty() && !options.budgets.empty() &&
+		!options.strace.empty();
+}
+
+int main(int argc, char **argv)
+{
+	ScaleOptions options;
+
+	if (!scale_parse_options(argc, argv, options)) {
+		fmt::print("Usage: {0:s} <discovery|small-files|large-asset> --binary <path> --work <path> "
+			"--budgets <file> --strace <path> [--asset-size <bytes>] [--record]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ScaleScenario scenario = {options.scenario};
+
+	if (scenario.name == "discovery") {
+		scenario.templates = 10000;
+	} else if (scenario.name == "small-files") {
+		scenario.files = 100000;
+	} else if (scenario.name == "large-asset") {
+		scenario.asset_size = options.asset_size;
+	} else {
+		fmt::print("Unknown scenario: {0:s}\n", scenario.name);
+		return EXIT_FAILURE;
+	}
+
+	file_path scenario_path = options.work.string() + "/" + scenario.name;
+	file_path templates_path = scenario_path.string() + "/templates";
+	file_path output_path = scenario_path.string() + "/output";
+	file_path home_path = scenario_path.string() + "/home";
+	file_path stamp_path = scenario_path.string() + "/corpus.json";
+	json stamp = {{"templates", scenario.templates}, {"files", scenario.files}, {"asset_size", scenario.asset_size}};
+	error_code error;
+
+	file_input budgets_stream(options.budgets);
+	json budgets = json::parse(budgets_stream, nullptr, false);
+	budgets_stream.close();
+
+	if (budgets.is_discarded()) {
+		budgets = json::object();
+	}
+	if (!options.record && !budgets.contains(scenario.name)) {
+		// Budgets are machine-specific, nothing is synthesized until they're recorded
+		fmt::print("Skipping {0:s}, no budgets recorded (record them with --record)\n", scenario.name);
+		return scale_skip_code;
+	}
+
+	// The corpus is reused between runs unless its parameters changed
+	file_input stamp_stream(stamp_path);
+	json previous_stamp = json::parse(stamp_stream, nullptr, false);
+
+	if (previous_stamp.is_discarded() || previous_stamp != stamp) {
+		fmt::print("Synthesizing corpus: {0:s}\n", scenario_path.string());
+		steady_clock::time_point start = steady_clock::now();
+		filesystem::remove_all(scenario_path, error);
+		filesystem::create_directories(templates_path, error);
+
+		if (!scale_synthesize(scenario, templates_path)) {
+			fmt::print("Cannot synthesize corpus: {0:s}\n", scenario_path.string());
+			return EXIT_FAILURE;
+		}
+
+		file_output stream(stamp_path);
+		stream << stamp.dump() << "\n";
+		fmt::print("Synthesized corpus in {0:.1f}s\n",
+			std::chrono::duration<double>(steady_clock::now() - start).count());
+	}
+
+	vector<string> arguments = {options.binary.string()};
+
+	if (scenario.name == "discovery") {
+		arguments.insert(arguments.end(), {"--list", "-s", templates_path.string()});
+	} else {
+		arguments.insert(arguments.end(), {"-t", scenario.name, "-s", templates_path.string(),
+			"-o", output_path.string(), "--skip-runners", "--durability", "none"});
+	}
+
+	ScaleMeasurement measured;
+	ScaleMeasurement traced;
+	// Tracing slows the binary down, so syscalls are counted in a separate run
+	vector<string> strace_arguments = {options.strace.string(), "-f", "-c", "-o",
+		scenario_path.string() + "/strace.txt", "--"};
+	strace_arguments.insert(strace_arguments.end(), arguments.begin(), arguments.end());
+	filesystem::create_directories(home_path, error);
+	filesystem::remove_all(output_path, error);
+
+	if (!scale_execute(arguments, home_path, scenario_path.string() + "/run.log", measured)) {
+		fmt::print("proyekgen failed, see {0:s}/run.log\n", scenario_path.string());
+		return EXIT_FAILURE;
+	}
+
+	filesystem::remove_all(output_path, error);
+
+	if (!scale_execute(strace_arguments, home_path, scenario_path.string() + "/strace.log", traced)) {
+		fmt::print("proyekgen failed under strace, see {0:s}/strace.log\n", scenario_path.string());
+		return EXIT_FAILURE;
+	}
+
+	measured.syscalls = scale_parse_strace(scenario_path.string() + "/strace.txt");
+
+	if (measured.syscalls == 0) {
+		fmt::print("Cannot count syscalls, see {0:s}/strace.txt\n", scenario_path.string());
+		return EXIT_FAILURE;
+	}
+
+	filesystem::remove_all(output_path, error);
+	fmt::print("{0:s}: {1:.2f}s wall, {2:.1f} MiB peak RSS, {3:d} syscalls\n", scenario.name,
+		measured.wall_seconds, measured.peak_rss_mib, measured.syscalls);
+
+	if (options.record) {
+		// Budgets leave headroom over the recorded measurements for noisy machines
+		budgets[scenario.name]["wall_seconds"] = std::ceil(measured.wall_seconds * 1.5 * 100) / 100;
+		budgets[scenario.name]["peak_rss_mib"] = std::ceil(measured.peak_rss_mib * 1.5);
+		budgets[scenario.name]["syscalls"] = static_cast<uintmax_t>(measured.syscalls * 1.5);
+
+		file_output stream(options.budgets);
+		stream << budgets.dump(1, '\t') << "\n";
+		fmt::print("Recorded budgets into {0:s}\n", options.budgets.string());
+		return EXIT_SUCCESS;
+	}
+	json budget = budgets[scenario.name];
+	bool exceeded = false;
+
+	// Every measurement must have a budget, a partially recorded scenario fails
+	for (const char *name : {"wall_seconds", "peak_rss_mib", "syscalls"}) {
+		if (!budget.contains(name) || !budget[name].is_number()) {
+			fmt::print("No {0:s} budget recorded for {1:s}, run with --record first\n", name, scenario.name);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (measured.wall_seconds > budget.value("wall_seconds", 0.0)) {
+		fmt::print("Wall time {0:.2f}s exceeds the budget of {1:.2f}s\n", measured.wall_seconds,
+			budget.value("wall_seconds", 0.0));
+		exceeded = true;
+	}
+	if (measured.peak_rss_mib > budget.value("peak_rss_mib", 0.0)) {
+		fmt::print("Peak RSS {0:.1f} MiB exceeds the budget of {1:.1f} MiB\n", measured.peak_rss_mib,
+			budget.value("peak_rss_mib", 0.0));
+		exceeded = true;
+	}
+	if (measured.syscalls > budget["syscalls"].get<uintmax_t>()) {
+		fmt::print("{0:d} syscalls exceed the budget of {1:d}\n", measured.syscalls,
+			budget["syscalls"].get<uintmax_t>());
+		exceeded = true;
+	}
+
+	return exceeded ? EXIT_FAILURE : EXIT_SUCCESS;
+}
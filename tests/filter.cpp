@@ -0,0 +1,80 @@
+/*
+	proyekgen - A simple project generator
+	Copyright (C) 2023 spirothXYZ
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the glob patterns of template feature groups against known paths.
+ *
+ * Usage: proyekgen-filter-test
+*/
+
+#include "filter.h"
+
+/*
+ * A pattern, a path and whether the pattern is expected to match it.
+*/
+struct FilterCase
+{
+	const char *pattern;
+	const char *pathname;
+	bool expected;
+};
+
+int main()
+{
+	const FilterCase cases[] = {
+		// "**/" matches whole directories only
+		{"**/foo", "foo", true},
+		{"**/foo", "a/foo", true},
+		{"**/foo", "a/b/foo", true},
+		{"**/foo", "afoo", false},
+		{"**/foo", "a/bfoo", false},
+		{"**/foo", "a/foo/b", false},
+		{"a/**/b", "a/b", true},
+		{"a/**/b", "a/x/b", true},
+		{"a/**/b", "a/x/y/b", true},
+		{"a/**/b", "a/xb", false},
+		{"a/**/b", "a/x/yb", false},
+		{"a/**/b", "ab", false},
+		{"a/**", "a", true},
+		{"a/**", "a/x", true},
+		{"a/**", "a/x/y", true},
+		{"a/**", "ab", false},
+		{"a/**", "b/a/x", false},
+		// Single "*" and "?" never cross directories
+		{"src/*.cpp", "src/main.cpp", true},
+		{"src/*.cpp", "src/a/main.cpp", false},
+		{"src/?.h", "src/a.h", true},
+		{"src/?.h", "src//.h", false},
+		// Patterns without a "/" match the file name at any depth
+		{"*.md", "docs/guide/index.md", true},
+		{"test_*", "src/test_main.cpp", true},
+		{"test_*", "test_dir/main.cpp", false}
+	};
+	int failures = 0;
+
+	for (const FilterCase &c : cases) {
+		if (TemplateFilter::match(c.pattern, c.pathname) != c.expected) {
+			fmt::print("\"{0:s}\" {1:s} \"{2:s}\"\n", c.pattern, c.expected ? "should match" : "shouldn't match",
+				c.pathname);
+			failures++;
+		}
+	}
+
+	fmt::print("{0:d} of {1:d} glob cases passed\n", std::size(cases) - failures, std::size(cases));
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}